@@ -1,5 +1,5 @@
 echo building all targets
 echo building release
-g++ --std=c++11 -Wall -Wno-unused-but-set-variable -I includes/ -lncurses -o binaries/logicsim sources/*.cpp includes/*.hpp includes/*.h
+g++ --std=c++11 -pthread -Wall -Wno-unused-but-set-variable -I includes/ -lncurses -o binaries/logicsim sources/*.cpp includes/*.hpp includes/*.h
 echo building debug
-g++ -g --std=c++11 -Wall -Wno-unused-but-set-variable -I includes/ -lncurses -o binaries/logicsim.debug sources/*.cpp includes/*.hpp includes/*.h
+g++ -g --std=c++11 -pthread -Wall -Wno-unused-but-set-variable -I includes/ -lncurses -o binaries/logicsim.debug sources/*.cpp includes/*.hpp includes/*.h
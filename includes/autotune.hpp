@@ -0,0 +1,47 @@
+/*
+ * Picks the fastest way to simulate a circuit on the current machine by benchmarking the alternatives, and remembers the choice
+ * in a cache file so that later runs on the same machine and circuit can skip the benchmark.
+ */
+
+#ifndef LGS_INCLUDE_AUTOTUNE
+#define LGS_INCLUDE_AUTOTUNE
+
+#include <string>
+#include <vector>
+
+#include <engine.hpp>
+
+namespace lgs
+{
+        /*
+         * A way to simulate a circuit: the name of the engine, and the side of the tiles the board is partitioned into for the
+         * engines that use tiles.
+         */
+        struct TuneChoice
+        {
+                std::string engine;
+                int tile_size;
+        };
+
+        /*
+         * Looks up the TuneChoice for the given circuit in the cache file at cachePath, under a key made of a hash of the circuit and
+         * the CPU model. Returns false on a miss, and also if the cache or the entry is malformed, so that the circuit is tuned again.
+         */
+        bool cachedTuneChoice(const unsigned int* crd, int w, int h, const std::string& cachePath, TuneChoice& choice);
+
+        /*
+         * Returns the fastest TuneChoice for the given circuit and stores it in the cache file at cachePath. Each candidate is set up
+         * with the options of the actual run, starting from the given state, which should be taken from the actual run after its 
+         * first LGS_AUTOTUNE_RUN_TICKS ticks so that the board is as busy as it will be. Each is then benchmarked for about 
+         * LGS_AUTOTUNE_TRIAL_TIME milliseconds. No peripherals run, so the driven bits are held at their values in the state.
+         */
+        TuneChoice autotune(const unsigned int* crd, int w, int h, const EngineOptions& options, const bool* state, 
+                        const std::string& cachePath);
+
+        /*
+         * Returns the default path of the autotuner cache file, in the home directory of the user.
+         */
+        std::string defaultAutotuneCachePath();
+}
+
+#endif
@@ -6,49 +6,96 @@
 #define LGS_INCLUDE_CPU_WORKER 
 
 #include <vector>
+#include <utility>
+#include <string>
 
-#ifdef LGS_PROFILE
-#include <chrono>
-#endif
+#include <engine.hpp>
 
 namespace lgs
 {
-        // Forward declaration
-        class Peripheral;
-#ifdef LGS_PROFILE
-        class PrintSection;
-#endif
-
         /*
-         * A CPU worker class that simulates a specified chunk of the logic board. Handles its own state memory.
+         * A CPU worker class that simulates a specified chunk of the logic board. Handles its own state memory. Backs the "dense", 
+         * "regions" and "xprop" engines.
          *
          * Note: States outside the logic board boundary are assumed to be 0.
          *
          */
-        class CPUWorker
+        class CPUWorker : public Engine
         {
                 private:
                         const unsigned int* circuit_data;
-                        const int width;
-                        const int height;
+                        int width;
+                        int height;
                         bool* state_r;                                          // Last state, to be read.
                         bool* state_w;                                          // Next state, to be written.
-                        const std::vector<Peripheral*> peripherals;                        
-#ifdef LGS_PROFILE
-                        int profile_n_ticks;
-                        std::chrono::steady_clock::duration profile_time_logic;
-                        std::chrono::steady_clock::duration profile_time_peripherals;
-                        PrintSection* prof_sec;
-#endif 
-
+                        const std::vector<std::pair<int, int>> driven;          // Positions of the bits driven by peripherals.
+                        bool* cone_mask;                                        // Cells simulated in cone of influence mode, NULL otherwise.
+                        std::vector<int> cone_cells;                            // Indices of the cells set in cone_mask, in increasing order.
+                        bool* known_r;                                          // Known (non-X) plane of the last state in X mode, NULL otherwise.
+                        bool* known_w;                                          // Known plane of the next state in X mode.
+                        std::vector<int> driven_cells;                          // Indices of the bits driven by peripherals.
+                        std::vector<int> x_observed;                            // Indices of the observed bits waited on in X mode.
+                        unsigned char* cell_kernel;                             // RegionKernel of each logic element in region mode, NULL otherwise.
+                        std::vector<std::pair<int, int>> dense_spans;           // [begin, end) index ranges of rows of KERNEL_DENSE elements.
+                        std::vector<int> halo_cells;                            // Other elements read by KERNEL_ACTIVITY elements.
+                        std::vector<int> driven_active_cells;                   // Driven KERNEL_ACTIVITY elements, evaluated every tick.
+                        std::vector<int> changed_cells;                         // Bits that changed in the last tick and that matter to activity.
+                        std::vector<int> dirty_cells;                           // KERNEL_ACTIVITY elements evaluated in this tick.
+                        bool* dirty;                                            // Flags for the elements in dirty_cells.
+                        bool activity_primed;                                   // False until all KERNEL_ACTIVITY elements are evaluated once.
+                        long int n_ticks;                                       // Number of ticks simulated so far.
+                        long int settle_tick;                                   // Tick at which all observed bits became known, -1 if not yet.
+                        int n_cone_cells;                                       // Size of the cone of influence, for the report.
+                        int n_active_cells;                                     // Number of KERNEL_ACTIVITY elements, for the report.
 
+                        bool eval_cell(const bool* state_r, int x, int y) const;        // Next state of the logic element at x, y.
+                        int input_index(int x, int y, int i) const;             // Index of the bit read as input ai by x, y, or -1 if outside.
+                        bool eval_cell_x(const bool* state_r, const bool* known_r, int x, int y, bool& known) const;  // As eval_cell, in X mode.
                         void sim_step(const bool* state_r, bool* state_w);      // Simulate one step
+                        void sim_step_x(const bool* state_r, const bool* known_r, bool* state_w, bool* known_w);    // Simulate one step in X mode
+                        void sim_step_regions(const bool* state_r, bool* state_w);      // Simulate one step in region mode
+                        void mark_readers_dirty(int p);                         // Adds the KERNEL_ACTIVITY elements reading bit p to dirty_cells.
+                        void collect_changes(const bool* state_r, const bool* state_w);     // Fills changed_cells after a tick in region mode
                 public:
-                        CPUWorker(const unsigned int* crd, const int w, const int h, const std::vector<Peripheral*>& ps);    // crd is circuit_data
+                        CPUWorker(const std::vector<std::pair<int, int>>& drivenPins);
                         ~CPUWorker();
 
-                        void tickSimulation();                                  // Simulate one step
-                        const bool* getState();                                 // Returns current(last) state. Does not allow state to be modified externally. 
+                        void loadCircuit(const unsigned int* crd, int w, int h) override;
+                        void loadState(const bool* state);                      // Sets the current state, before any mode is set up.
+                        void evaluate() override;
+                        bool* getNextState() override;
+                        void commit() override;
+                        const bool* getState() override;                        // Returns current(last) state. Does not allow state to be modified externally. 
+                        const bool* getKnown() override;                        // Returns the current known plane, or NULL if not in X mode.
+                        const bool* getMask() override;                         // Returns cells simulated in cone mode, or NULL if not in cone mode.
+                        std::string getReport() override;                       // Reports the sizes of the cone and regions, and the settle tick.
+                        bool isStable() override;                               // Compares the two state buffers, always false in region mode.
+
+                        /*
+                         * Restricts simulation to the cone of influence of the given observed bits, that is, to the logic elements whose
+                         * outputs can reach an observed bit through a chain of inputs that the truth tables actually depend on. Logic 
+                         * elements outside the cone are no longer simulated and hold 0 (peripherals may still write to them). Returns the
+                         * number of logic elements in the cone. Out of bound positions are ignored.
+                         */
+                        int restrictToCone(const std::vector<std::pair<int, int>>& observed);
+
+                        /*
+                         * Switches to three valued 0/1/X simulation. All bits start as X (unknown), bits outside the board are a known 0, 
+                         * and logic elements output X unless their truth table gives the same value for every assignment of their X 
+                         * inputs. Bits that peripherals drive are treated as known. The known plane is stored alongside the state, where 
+                         * X bits read as 0. The tick at which all the given observed bits first become known is recorded.
+                         */
+                        void enableXPropagation(const std::vector<std::pair<int, int>>& observed);
+                        long int getSettleTick();                               // Returns tick at which observed bits became known, or -1.
+
+                        /*
+                         * Partitions the board into square tiles of side tileSize and simulates each tile with the kernel that suits it. The
+                         * kernel is picked by a cost model from the activity of the tile over a short trial run from the current state, which
+                         * does not advance the simulation. The given regions override the choice for the elements they cover. Boundaries 
+                         * between regions are exact: changes of bits read across a boundary are passed on every tick. Returns the number of 
+                         * logic elements assigned to KERNEL_ACTIVITY.
+                         */
+                        int assignRegions(const std::vector<Region>& overrides, int tileSize);
 
         };
 }
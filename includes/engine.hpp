@@ -0,0 +1,86 @@
+/*
+ * Defines the interface between the frontend and the simulation engines. An engine holds the state of the logic board and advances
+ * it tick by tick. Engines are picked at runtime by name, so different kernels can be run on the same circuit and peripherals.
+ */
+
+#ifndef LGS_INCLUDE_ENGINE
+#define LGS_INCLUDE_ENGINE
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <lane.hpp>
+
+namespace lgs
+{
+        /*
+         * The kernels that can simulate a region of the board. KERNEL_DENSE evaluates every logic element of the region each tick.
+         * KERNEL_ACTIVITY only evaluates the logic elements some input of which changed in the last tick, which suits regions that
+         * are mostly quiet, like memories.
+         */
+        enum RegionKernel { KERNEL_DENSE, KERNEL_ACTIVITY };
+
+        /*
+         * A rectangular region of the board together with the kernel simulating it.
+         */
+        struct Region
+        {
+                int x, y, w, h;
+                RegionKernel kernel;
+        };
+
+        /*
+         * Everything about the system beyond the circuit that an engine may use. Engines ignore what they do not support.
+         */
+        struct EngineOptions
+        {
+                std::vector<std::pair<int, int>> observed;              // Bits read by peripherals and probes.
+                std::vector<std::pair<int, int>> driven;                // Bits written by peripherals.
+                bool cone;                                              // Only simulate the cone of influence of the observed bits.
+                std::vector<Region> regions;                            // Regions whose kernel is fixed by the system json.
+                int tile_size;                                          // Side of the tiles the board is partitioned into.
+                const bool* state;                                      // State to start from, or NULL to start from all 0.
+        };
+
+        /*
+         * Abstract base class for engines. A tick is done in three steps: evaluate() computes the next state from the current one,
+         * then peripherals read getState() and write to getNextState(), and commit() applies their writes and makes the next state
+         * current. Peripheral writes may only go to the driven bits named in the EngineOptions. Peripherals reach the state only
+         * through gatherLanes() and scatterLanes(), which engines with their own state layout may override.
+         *
+         * Note: States outside the logic board boundary are assumed to be 0.
+         */
+        class Engine
+        {
+                public:
+                        virtual ~Engine() {}
+
+                        virtual void loadCircuit(const unsigned int* crd, int w, int h) = 0;    // Load circuit, with all bits 0. crd is circuit_data.
+                        virtual void evaluate() = 0;                                            // Compute next state from current state.
+                        virtual bool* getNextState() = 0;                                       // Next state, for peripheral writes.
+                        virtual void commit() = 0;                                              // Apply peripheral writes, next state becomes current.
+                        virtual const bool* getState() = 0;                                     // Current state.
+                        virtual void step(int n);                                               // Simulate n ticks without peripherals.
+                        virtual void gatherLanes(const LaneSet& lanes, LaneWord* words);        // Read the lanes from the current state.
+                        virtual void scatterLanes(const LaneSet& lanes, const LaneWord* words, const bool* drive);      // Write driven lanes to next state.
+
+                        virtual const bool* getKnown();         // Bits that are not X, or NULL if the engine does not model X.
+                        virtual const bool* getMask();          // Bits that are simulated, or NULL if all are.
+                        virtual std::string getReport();        // Engine specific statistics to show at the end of a run.
+                        virtual bool isStable();                // True only if the last tick changed no bit. Engines may always say false.
+        };
+
+        /*
+         * The names of the available engines. "dense" simulates every logic element every tick, "regions" picks a kernel per region of
+         * the board as done by CPUWorker::assignRegions, and "xprop" simulates three valued 0/1/X logic starting from all X.
+         */
+        std::vector<std::string> engineNames();
+
+        /*
+         * Factory function that produces the named engine, loaded with the given circuit and set up with the given options.
+         */
+        Engine* engineFromName(const std::string& name, const unsigned int* crd, int w, int h, const EngineOptions& options);
+}
+
+#endif
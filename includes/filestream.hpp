@@ -0,0 +1,52 @@
+/*
+ * Streams bytes between a file and the simulation thread through a large buffer, with the file io done on a background thread.
+ */
+
+#ifndef LGS_INCLUDE_FILE_STREAM
+#define LGS_INCLUDE_FILE_STREAM
+
+#include <string>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <cstddef>
+
+#include <spscqueue.hpp>
+
+namespace lgs
+{
+        /*
+         * A file opened for either reading or writing. A reading stream's thread keeps the buffer filled from the file in chunks of
+         * LGS_FILE_CHUNK_SIZE bytes, and a writing stream's thread writes out what was buffered. Either way the simulation thread
+         * only touches the buffer, never the file. Closing a writing stream writes out everything buffered before closing the file.
+         * A failure to read, write or close the file is only recorded, for the owner to check with hasFailed().
+         */
+        class FileStream
+        {
+                private:
+                        SPSCQueue<unsigned char> buffer;
+                        std::FILE* file;
+                        const std::string path;
+                        const bool writing;
+                        std::atomic<bool> closing;                      // Set by close().
+                        std::atomic<bool> file_ended;                   // Set once a reading stream read the whole file.
+                        std::atomic<bool> failed;                       // Set once reading, writing or closing the file failed.
+                        std::thread worker;
+
+                        void run();                                     // Background thread main loop.
+                public:
+                        FileStream(const std::string& path, bool write);
+                        ~FileStream();
+
+                        bool read(unsigned char& byte);                 // Reading streams. False if no byte is buffered.
+                        bool atEnd() const;                             // Reading streams. True once every byte of the file was read.
+                        bool write(unsigned char byte);                 // Writing streams. False if the buffer is full.
+                        bool canWrite() const;                          // Writing streams. True if the buffer is not full.
+                        void writeAll(const unsigned char* bytes, std::size_t n);      // Writing streams. Waits for room if needed.
+                        void close();                                   // Flush and stop the thread, may be called more than once.
+                        bool hasFailed() const;                         // True once bytes were lost to a failed read, write or close.
+                        const std::string& getPath() const;
+        };
+}
+
+#endif
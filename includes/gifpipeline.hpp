@@ -0,0 +1,128 @@
+/*
+ * Writes the states of the board to the output gif in the background.
+ */
+
+#ifndef LGS_INCLUDE_GIF_PIPELINE
+#define LGS_INCLUDE_GIF_PIPELINE
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+namespace lgs
+{
+        /*
+         * How a pixel of a shrunk output gif pools the bits it covers. POOLING_OR shows 1 if any of them is 1, POOLING_MAJORITY if
+         * more than half are, and POOLING_ACTIVITY if any changed since the frame before.
+         */
+        enum OutputPooling { POOLING_OR, POOLING_MAJORITY, POOLING_ACTIVITY };
+
+        /*
+         * The region of the board shown in the output gif, and its scale. Each bit is drawn as scale by scale pixels, or, if shrink
+         * is above 1, each shrink by shrink block of bits is pooled into one pixel. A negative w or h extends the region to the edge
+         * of the board.
+         */
+        struct OutputView
+        {
+                int x, y, w, h;
+                int scale;
+                int shrink;
+                OutputPooling pooling;
+        };
+
+        /*
+         * Encodes frames of the output gif off the simulation thread. capture() packs the view of the state, with the known and mask
+         * planes if the engine has them, into bits in the next slot of a ring of LGS_GIF_RING_SIZE slots, pooling the bits if the view
+         * is shrunk, and only waits if the ring is full. A pooled pixel is masked only if all its bits are, and X if any simulated
+         * bit is, so the cost of a frame follows the size of the view and not of the board.
+         * A differ thread takes the captured frames in order and maps each bit to its index in the fixed palette of 0, 1, X and
+         * masked colors. It crops each frame to the rectangle of bits that changed since the frame before, leaving the unchanged
+         * bits in it transparent, and folds a frame with no change into the delay of the frame before. Up to LGS_GIF_ENCODERS
+         * encoder threads LZW compress the cropped frames into memory, one scaled scanline at a time so no scaled frame is ever held,
+         * and whichever encoder completes the next frame appends it to the file.
+         *
+         * Frames are never dropped. Instead the number of times and the total time the simulation waited on a full ring are
+         * reported, along with the deepest the ring got.
+         */
+        class GifPipeline
+        {
+                private:
+                        struct Slot
+                        {
+                                uint64_t* bits;                                 // State, then known plane, then mask plane.
+                                bool has_known;
+                                bool has_mask;
+                                bool full;                                      // Captured and not yet diffed.
+                        };
+
+                        /*
+                         * A cropped frame waiting to be compressed. image holds the palette index of each bit in the rectangle, row
+                         * by row, and is not scaled. delay is in the units of the gif, as is the frame time.
+                         */
+                        struct Job
+                        {
+                                long int frame;                                 // Position among the written frames.
+                                int x, y, w, h;
+                                int delay;
+                                uint8_t* image;
+                        };
+
+                        const int board_width;
+                        const OutputView view;
+                        const int width;                                        // Pixels in the gif, before scaling.
+                        const int height;
+                        const int scale;
+                        const int frame_time;
+                        const int n_words;                                      // Words in one plane.
+                        FILE* file;
+                        bool* last_state;                                       // State of the view at the last capture, for activity pooling.
+                        bool has_last;
+                        Slot* slots;
+                        std::thread differ;
+                        std::vector<std::thread> encoders;
+                        std::vector<Job> free_jobs;                             // Buffers for cropped frames.
+                        std::deque<Job> jobs;                                   // Cropped frames, in order.
+                        std::mutex lock;
+                        std::condition_variable slot_freed;
+                        std::condition_variable frame_captured;
+                        std::condition_variable job_freed;
+                        std::condition_variable job_ready;
+                        long int n_captured;
+                        long int n_diffed;
+                        bool diffed_all;                                        // Set once the differ has queued the last frame.
+                        long int n_jobs;                                        // Frames queued by the differ, after merging.
+                        long int n_written;
+                        std::map<long int, std::pair<char*, size_t>> encoded;   // Encoded frames waiting for earlier ones.
+                        bool finishing;
+                        int max_depth;                                          // Most frames captured and not yet diffed.
+                        long int n_stalls;
+                        std::chrono::steady_clock::duration stall_time;
+
+                        void run_differ();
+                        void run_encoder();
+                        void pack(Slot& slot, const bool* state, const bool* known, const bool* mask);
+                        void to_indices(const Slot& slot, uint8_t* indices) const;     // Maps a frame to palette indices.
+                        Job take_job();                                         // Waits for a free buffer.
+                        void queue_job(const Job& job);
+                        void encode(FILE* f, const Job& job) const;             // Writes one frame, with its LZW image.
+
+                public:
+                        GifPipeline(const std::string& path, int boardWidth, const OutputView& outputView, int frameTime);
+                        ~GifPipeline();
+                        GifPipeline(const GifPipeline&) = delete;
+                        GifPipeline& operator=(const GifPipeline&) = delete;
+
+                        void capture(const bool* state, const bool* known, const bool* mask);  // Known and mask may be NULL.
+                        void finish();                                          // Writes all captured frames and ends the file.
+                        std::string getReport();
+        };
+}
+
+#endif
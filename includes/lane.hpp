@@ -0,0 +1,66 @@
+/*
+ * Defines lanes, the buses through which peripherals read from and write to the board. A lane is an ordered list of up to 
+ * LGS_LANE_MAX_BITS bits of the board, seen by peripherals as a single word whose i'th bit is the i'th bit of the lane.
+ */
+
+#ifndef LGS_INCLUDE_LANE
+#define LGS_INCLUDE_LANE
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+#include <json.hpp>
+
+/*
+ * The maximum number of bits in a lane, the width of LaneWord.
+ */
+#define LGS_LANE_MAX_BITS 64
+
+namespace lgs
+{
+        /*
+         * The value of a lane.
+         */
+        typedef std::uint64_t LaneWord;
+
+        /*
+         * An ordered list of positions on the board. Positions outside the board read as 0 and ignore writes.
+         */
+        class Lane
+        {
+                private:
+                        std::vector<std::pair<int, int>> bits;
+                public:
+                        Lane();
+                        Lane(const std::vector<std::pair<int, int>>& positions);
+
+                        int size() const;                                                       // Number of bits.
+                        const std::vector<std::pair<int, int>>& getPositions() const;           // Position of each bit.
+        };
+
+        /*
+         * Factory function that reads a lane from JSON. Three forms are accepted. An array of JSON objects, each with 2 integer
+         * fields "X" and "Y", lists the positions of the bits in order. A single JSON object with fields "X" and "Y" is a lane of one
+         * bit. A JSON object that also has an integer field "Length" is a strided range of that many bits, the i'th of which is at
+         * ("X" + i * "Step X", "Y" + i * "Step Y"), where the optional integer fields "Step X" and "Step Y" default to 1 and 0.
+         */
+        Lane laneFromJson(const nlohmann::json& laneJson);
+
+        /*
+         * Lanes flattened into board indices for a board of given size, so that they can be gathered from and scattered to the
+         * state in one pass. The bits of lane i are cells[begins[i]] to cells[begins[i+1] - 1], with -1 for bits outside the board.
+         */
+        struct LaneSet
+        {
+                std::vector<int> cells;
+                std::vector<int> begins;
+
+                LaneSet();
+                void add(const Lane& lane, int w, int h);                       // Appends lane as the last lane of the set.
+                int size() const;                                               // Number of lanes.
+                std::vector<std::pair<int, int>> getPositions(int w) const;     // Positions of all bits inside the board.
+        };
+}
+
+#endif
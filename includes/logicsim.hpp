@@ -19,6 +19,48 @@
 
 #endif
 
+/*
+ * The default side length of the square tiles the board is partitioned into in region mode.
+ */
+#define LGS_REGION_TILE_SIZE 32
+
+/*
+ * The number of ticks of the trial run from which the activity of each tile is measured in region mode.
+ */
+#define LGS_REGION_SAMPLE_TICKS 256
+
+/*
+ * The cost of evaluating a logic element in an activity driven region relative to a densely simulated one, per change. Tiles
+ * where this times the number of changes per tick is below the number of elements are simulated with the activity kernel.
+ */
+#define LGS_REGION_ACTIVITY_COST 8
+
+/*
+ * The number of ticks of the actual run, with peripherals, after which the autotuner benchmarks the candidates from the state reached.
+ */
+#define LGS_AUTOTUNE_RUN_TICKS 1000
+
+/*
+ * The number of milliseconds for which the autotuner benchmarks each candidate, after LGS_AUTOTUNE_WARMUP_TICKS untimed ticks.
+ */
+#define LGS_AUTOTUNE_TRIAL_TIME 200
+#define LGS_AUTOTUNE_WARMUP_TICKS 16
+
+/*
+ * Name of the autotuner cache file, kept in the home directory of the user.
+ */
+#define LGS_AUTOTUNE_CACHE_FILE ".logicsim-autotune.json"
+
+/*
+ * The default engine, see engine.hpp.
+ */
+#define LGS_DEFAULT_ENGINE "dense"
+
+/*
+ * The default number of ticks by which peripherals may lag behind the logic. 0 ticks peripherals synchronously.
+ */
+#define LGS_DEFAULT_PIPELINE_DEPTH 0
+
 /*
  * The default number of ticks for which to simulate. Negative values indicate indefinite simulation.
  */
@@ -30,6 +72,12 @@
  */
 #define LGS_DEFAULT_PRINT_STEPS -1
 
+/*
+ * The default number of ticks between checks for changed print sections to log in headless mode. Logging does not depend on the
+ * print steps, so states are logged even if no intermediate state is printed.
+ */
+#define LGS_DEFAULT_LOG_STEPS 1000
+
 /*
  * The default time in milliseconds between each frame of the outputted gif.
  */
@@ -57,8 +105,81 @@
 #define LGS_GIF_COLOR_1_A 255
 
 /*
- * The number of milliseconds to wait between listening for keyboard events. Use the time-keyboard script to find the system-specific optimal value.
+ * RGBA color value to use for X (unknown) state in output gif in X propagation mode.
+ */
+#define LGS_GIF_COLOR_X_R 255
+#define LGS_GIF_COLOR_X_G 0
+#define LGS_GIF_COLOR_X_B 0
+#define LGS_GIF_COLOR_X_A 255
+
+/*
+ * RGBA color value to use in the output gif for bits outside the simulated cone of influence.
+ */
+#define LGS_GIF_COLOR_MASK_R 96
+#define LGS_GIF_COLOR_MASK_G 0
+#define LGS_GIF_COLOR_MASK_B 96
+#define LGS_GIF_COLOR_MASK_A 255
+
+/*
+ * Frames of the output gif that can be captured ahead of the encoders, and the number of encoder threads.
+ */
+#define LGS_GIF_RING_SIZE 16
+#define LGS_GIF_ENCODERS 3
+
+/*
+ * The number of milliseconds after its last keystroke that a key is taken to be released, as terminals do not report key releases. This is 
+ * also how often the input thread wakes up when no keys come. Use the time-keyboard script to find the system-specific optimal value.
  */
 #define LGS_KEYBOARD_WAIT_TIME 25
 
+/*
+ * The number of key events the input thread can queue up for the simulation.
+ */
+#define LGS_KEY_QUEUE_SIZE 256
+
+/*
+ * The minimum number of milliseconds between two redraws of the screen by the UI thread.
+ */
+#define LGS_SCREEN_FRAME_TIME 33
+
+/*
+ * The minimum number of milliseconds between two updates of the text of an LEDArray. Changes in between are shown with the next update.
+ */
+#define LGS_LEDARRAY_UPDATE_TIME 33
+
+/*
+ * Bytes of circuit output buffered in headless mode before being written out.
+ */
+#define LGS_HEADLESS_BUFFER_SIZE (1 << 16)
+
+/*
+ * Milliseconds worth of ticks run in a batch by a paced simulation, and milliseconds it may fall behind before the schedule is moved up.
+ * An unpaced simulation runs batches of LGS_PACER_FREE_BATCH ticks.
+ */
+#define LGS_PACER_BATCH_TIME 10
+#define LGS_PACER_MAX_LAG 100
+#define LGS_PACER_FREE_BATCH (1 << 20)
+
+/*
+ * The maximum width of the address lane of a Memory peripheral, limiting memories to 2^LGS_MEMORY_MAX_ADDRESS_BITS words.
+ */
+#define LGS_MEMORY_MAX_ADDRESS_BITS 32
+
+/*
+ * Bytes buffered by FileReader and FileWriter peripherals, and bytes moved to or from the file at a time by their background thread.
+ */
+#define LGS_FILE_BUFFER_SIZE (1 << 20)
+#define LGS_FILE_CHUNK_SIZE (1 << 16)
+
+/*
+ * Milliseconds the background thread of a FileReader or FileWriter sleeps when it has nothing to do.
+ */
+#define LGS_FILE_IDLE_TIME 1
+
+/*
+ * Bytes buffered in each direction by a SerialPort, and milliseconds its background thread waits in poll() at a time.
+ */
+#define LGS_SERIAL_BUFFER_SIZE (1 << 16)
+#define LGS_SERIAL_POLL_TIME 1
+
 #endif 
@@ -1,12 +1,13 @@
 /*
  * Contains functions for keyboard key-state querying and displaying text output via the ncurses environment. Also handles 
- * entering into and safely exiting from ncurses mode.
+ * entering into and safely exiting from ncurses mode, and a headless mode that does the same without a terminal.
  */
 
 #ifndef LGS_INCLUDE_NCURSES_IO
 #define LGS_INCLUDE_NCURSES_IO
 
 #include <string>
+#include <chrono>
 
 namespace lgs
 {
@@ -16,6 +17,43 @@ namespace lgs
          */
         void initializeNcursesIO();
 
+        /*
+         * Called instead of initializeNcursesIO to run without a terminal. No key is ever pressed, print() goes to stderr, output of the
+         * circuit goes through a buffer to the file at outputPath, or to stdout if it is NULL, and PrintSections are only shown by 
+         * logPrintSections().
+         */
+        void initializeHeadlessIO(const char* outputPath);
+
+        /*
+         * Returns if initializeHeadlessIO was called.
+         */
+        bool isHeadless();
+
+        /*
+         * Key presses are read from the terminal by an input thread started by initializeNcursesIO, which queues key down and key up 
+         * events stamped with the last tick given here. Applies the queued events to the snapshot of key states read by the functions 
+         * below, and is to be called once per tick by the thread ticking peripherals, which is the only thread that may read the 
+         * snapshot. Returns true if some key went down or up.
+         */
+        bool updateKeySnapshot(long int tick);
+
+        /*
+         * Returns if key events are queued that the next updateKeySnapshot will apply. To be called by the same thread.
+         */
+        bool isKeyEventPending();
+
+        /*
+         * Sets the tick key events are stamped with, as updateKeySnapshot does, for ticks skipped without ticking peripherals.
+         */
+        void setKeyTick(long int tick);
+
+        /*
+         * Waits until a key event is queued or the deadline passes, and returns true in the first case. A deadline of the maximum time
+         * point waits for a key event without end. No key event ever comes in headless mode, where it returns false at once given
+         * the maximum time point.
+         */
+        bool waitForKeyEvent(std::chrono::steady_clock::time_point deadline);
+
         /*
          * Returns the state of given key with given keycode. 
          */
@@ -33,7 +71,7 @@ namespace lgs
         int getAnyPressedKey();
 
         /*
-         * Waits for key press.
+         * Waits for key press. Must not be called while peripherals are being ticked.
          */
         void waitForKey();
 
@@ -42,26 +80,38 @@ namespace lgs
          */
         void print(const std::string& str);
 
+        /*
+         * Print output of the circuit, like the characters of a CharStreamPrinter. Same as print() unless headless.
+         */
+        void printOutput(const std::string& str);
+
+        /*
+         * In headless mode, writes each PrintSection whose text changed since it was last logged to stderr, prefixed with the tick.
+         * Does nothing otherwise.
+         */
+        void logPrintSections(long int tick);
+
+        class Compositor;
+
         /*
          * Represents a section of the screen that can hold text. The text can be added to or replaced.
          * There can be multiple PrintSections, but the total length of text plus margins must fit 
-         * comfortably within the screen, otherwise undefined behavior occurs. The bottommost section is 
-         * not the part of any PrintSection - it is the exclusive target for print(above).
-         * PrintSections can solely be constructed via the getPrintSection... functions.
+         * comfortably within the screen, otherwise the text that does not fit is not shown. The bottommost 
+         * section is not the part of any PrintSection - it is the exclusive target for print(above).
+         *
+         * The screen is retained: changing a section or printing only changes the text kept in memory and
+         * marks the screen dirty. A UI thread started by initializeNcursesIO redraws the lines of the screen
+         * that changed at most once every LGS_SCREEN_FRAME_TIME, so callers never wait on the terminal.
          */
         class PrintSection
         {
                 private:
-                        PrintSection* next;
-                        bool is_end;
-                        int beg_lin;
+                        PrintSection* next;                         // Next section down the screen, NULL for the last.
                         std::string text;
+                        std::string logged;                         // Text last written by logPrintSections.
 
-                        void print_update();                        // Print text.
-                        void print_update_next();                   // Recursively prints all succeeding sections,
-                                                                    // and updates beg_lin for each section. Arguement is
-                                                                    // screen width. Returns total length of all print
-                                                                    // sections.
+                        friend class Compositor;
+                        friend void logPrintSections(long int tick);
                 
                 public:
 
@@ -73,13 +123,14 @@ namespace lgs
                         void addToEnd(const std::string&& str);             // Rvalue reference overloads.
                         void setText(const std::string&& txt);             
                         void addBackspace(size_t n);                        // Delete n characters from the end of the string.
-                        void reprint();                                     // Print contents immediately.
+                        void reprint();                                     // Redraw contents with the next frame.
 
         };
          
         /*
          * Deletes the character immediately before the cursor and moves cursor to the left by one character, does nothing if 
-         * at end of line. Essentially does what printing a backspace character would do.
+         * at end of line. Essentially does what printing a backspace character would do. In headless mode a backspace character
+         * is written to the output.
          */
         void backspace();
 
@@ -89,7 +140,8 @@ namespace lgs
         void clearScreen();
 
         /*
-         * Exits ncurses mode. If the boolean err is true, prints an error message and waits for a keypress before exiting.
+         * Exits ncurses mode and the program. If the boolean err is true, prints an error message and waits for a keypress before 
+         * exiting with EXIT_FAILURE, else exits with EXIT_SUCCESS. In headless mode flushes the output and exits without waiting.
          */
         void exitNcursesMode(bool err);
 }
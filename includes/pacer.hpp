@@ -0,0 +1,47 @@
+/*
+ * Paces the main loop of the simulation to a target tick rate.
+ */
+
+#ifndef LGS_INCLUDE_PACER
+#define LGS_INCLUDE_PACER
+
+#include <chrono>
+#include <string>
+
+namespace lgs
+{
+        /*
+         * Hands out ticks to run in batches, so that the simulation runs at a target number of ticks per second, or as fast as possible
+         * if the target is 0. A batch is LGS_PACER_BATCH_TIME milliseconds worth of ticks, and when fewer ticks than that are due the pacer 
+         * sleeps until a whole batch is. If the simulation falls more than LGS_PACER_MAX_LAG milliseconds behind, 
+         * the schedule is moved up instead of making up the lost ticks in a burst.
+         */
+        class Pacer
+        {
+                private:
+                        double rate;                                            // Ticks per second, 0 for as fast as possible.
+                        long int max_batch;
+                        std::chrono::steady_clock::time_point start;            // When tick 0 was due, as moved up.
+                        std::chrono::steady_clock::time_point began;
+                        long int n_ticks;                                       // Ticks handed out.
+                        long int n_batches;
+                        long int n_late;                                        // Times the schedule was moved up.
+                        std::chrono::steady_clock::duration slept;
+
+                public:
+                        Pacer(double ticksPerSecond);
+
+                        int nextBatch();                                        // Returns the number of ticks to run now, at least 1.
+
+                        /*
+                         * Hands out up to ticks more ticks that need no work, sleeping until they are due, and returns how many are due.
+                         * If wakeOnKey is set a key event ends the sleep early. Unpaced, returns ticks at once, except that if ticks is
+                         * LONG_MAX it waits for a key event and returns 0. Returns -1 at once if ticks is LONG_MAX and wakeOnKey is not
+                         * set, as nothing could ever end the wait, so that the caller can end the run instead.
+                         */
+                        long int skip(long int ticks, bool wakeOnKey);
+                        std::string getReport();                                // Achieved rate and schedule misses, if paced.
+        };
+}
+
+#endif
@@ -1,19 +1,23 @@
 /*
  * This header defines classes for the peripheral system. A peripheral is anything that reads bits from the state and writes bits to the state every tick.
- * Peripherals are attached to the CPUWorker by sending an array of peripherals to the worker. Peripherals execute parallely with the circuit and take 
- * precedence over the circuit.
+ * Peripherals are attached to the board through lanes (see lane.hpp), and are ticked by a Simulation. Peripherals execute parallely with the circuit and 
+ * take precedence over the circuit.
  */ 
 
 #ifndef LGS_INCLUDE_PERIPHERALS
 #define LGS_INCLUDE_PERIPHERALS 
 
 #include <vector>
-#include <array>
 #include <utility>
 #include <chrono>
+#include <cstddef>
 
 #include <json.hpp>
 
+#include <lane.hpp>
+#include <filestream.hpp>
+#include <seriallink.hpp>
+
 namespace lgs
 {
         /*
@@ -22,15 +26,117 @@ namespace lgs
         class PrintSection;
 
         /*
-         * An abstract base class for defining the peripheral interface.
+         * An abstract base class for defining the peripheral interface. A peripheral declares its input and output lanes once, when
+         * constructed, and never touches the state directly. Every tick, in[i] holds the value of the i'th input lane in the current
+         * state. To write the i'th output lane into the next state, the peripheral sets out[i] and drive[i]. Drive flags are cleared
+         * before every tick, so output lanes not driven in a tick are left to the circuit.
+         *
+         * By default a peripheral is ticked every tick. A peripheral that only reacts to the board may instead watch some of its
+         * input lanes, or stop polling altogether, and is then only ticked on the first tick, on ticks where a watched lane changed 
+         * since its last tick, and on the tick it asked for with wakeAfter(). While it is not ticked its outputs and drive flags hold
+         * their last values, and its lanes that are not watched may be stale. A peripheral reading keys may watch them instead of 
+         * polling, and is then also ticked on ticks where some key went down or up.
          */
         class Peripheral
         {
+                private:
+                        std::vector<Lane> input_lanes;
+                        std::vector<Lane> output_lanes;
+                        std::vector<int> watched_lanes;
+                        int wake_after;
+                        bool polling;
+                        bool watching_keys;
+                        long int tick_number;                                                           // Set by the Simulation before each tick.
+                        std::string error;                                                              // Set by fail(), empty if none.
+
+                        friend class PeripheralSet;
+                protected:
+                        int addInputLane(const Lane& lane);                                             // Returns the index of the new input lane.
+                        int addOutputLane(const Lane& lane);                                            // Returns the index of the new output lane.
+                        void watchInputLane(int lane);                                                  // Tick only when watched lanes change.
+                        void stopPolling();                                                             // Tick only when watched lanes change or woken.
+                        void watchKeys();                                                               // Also tick when a key goes down or up.
+                        void wakeAfter(int ticks);                                                      // Also tick after ticks more ticks, call from tick().
+                        long int getTickNumber() const;                                                 // Number of the current tick, from 0.
+                        void fail(const std::string& message);                                          // Ends the run with an error, call from tick().
+                public:
+                        Peripheral(const nlohmann::json& initJson) : wake_after(0), polling(true), watching_keys(false), tick_number(0) {}    // Force peripherals to provide constructor from json.
+                        virtual ~Peripheral() {}
+                        virtual void tick(const LaneWord* in, LaneWord* out, bool* drive) = 0;          // Do whatever the peripheral does
+                        virtual void finish();                                                          // Called once after the last tick.
+                        const std::vector<Lane>& getInputLanes() const;
+                        const std::vector<Lane>& getOutputLanes() const;
+                        const std::vector<int>& getWatchedLanes() const;
+                        bool isPolling() const;                                                         // True if ticked every tick.
+                        bool isWatchingKeys() const;
+                        int takeWakeRequest();                                                          // Ticks asked for by last tick, 0 if none.
+                        const std::string& getError() const;                                            // Message passed to fail(), empty if none.
+        };
+
+        /*
+         * A base class for peripherals written as a process: straight line code that waits for conditions on the board, instead of a
+         * state machine stepped by tick(). The body goes in run(), between LGS_PROCESS_BEGIN and LGS_PROCESS_END, and waits with 
+         * LGS_AWAIT, for example:
+         *
+         *      LGS_PROCESS_BEGIN
+         *      while(true)
+         *      {
+         *              LGS_AWAIT(waitFallingEdge(print_line));
+         *              code = readLane(char_lane);
+         *              ...
+         *      }
+         *      LGS_PROCESS_END
+         *
+         * run() is only resumed once the awaited condition holds: a falling or rising edge of a bit of an input lane, any change of
+         * an input lane, or a number of ticks. Input lanes are watched unless added with watched false, and only watched lanes can be
+         * waited on, so a waiting process costs the Simulation nothing until one of its lanes changes or its wait is over. Since run()
+         * returns at every wait, local variables do not survive an LGS_AWAIT, so state goes in members. Output lanes written with 
+         * writeLane() stay driven, across waits, until released with releaseLane().
+         */
+        class ProcessPeripheral : public Peripheral
+        {
+                private:
+                        enum WaitKind { WAIT_NONE, WAIT_FALLING, WAIT_RISING, WAIT_CHANGE, WAIT_TICKS, WAIT_FOREVER };
+
+                        WaitKind wait_kind;
+                        int wait_lane;
+                        LaneWord wait_bit;
+                        long int wait_until;
+                        const LaneWord* in_words;                                                       // Valid during run().
+                        std::vector<LaneWord> prev_words;                                               // Input lanes at the last tick.
+                        std::vector<LaneWord> out_words;
+                        std::vector<char> out_driven;
+                        std::vector<char> lane_watched;
+
+                        void wait_for(WaitKind kind, int lane, LaneWord bit);
+                protected:
+                        int resume_point;                                                               // Used by the LGS_PROCESS macros.
+
+                        virtual void run() = 0;                                                         // The process body.
+                        int addInputLane(const Lane& lane, bool watched = true);
+                        int addOutputLane(const Lane& lane);
+
+                        void waitFallingEdge(int lane, int bit = 0);
+                        void waitRisingEdge(int lane, int bit = 0);
+                        void waitChange(int lane);
+                        void waitTicks(int ticks);
+                        void waitForever();
+                        LaneWord readLane(int lane) const;
+                        void writeLane(int lane, LaneWord value);
+                        void releaseLane(int lane);
                 public:
-                        Peripheral(const nlohmann::json& initJson) {}                                    // Force peripherals to provide constructor from json.
-                        virtual void tick(const bool* stateR, bool* stateW, int w, int h) = 0;          // Do whatever the peripheral does
+                        ProcessPeripheral(const nlohmann::json& initJson);
+                        void tick(const LaneWord* in, LaneWord* out, bool* drive) override;
         };
 
+/*
+ * Macros delimiting and suspending the body of ProcessPeripheral::run(). LGS_AWAIT must not be used inside a switch statement of
+ * the body, and at most once per line.
+ */
+#define LGS_PROCESS_BEGIN switch(resume_point) { case 0:
+#define LGS_AWAIT(wait) do { wait; resume_point = __LINE__; return; case __LINE__:; } while(0)
+#define LGS_PROCESS_END } waitForever();
+
         // The following are the peripherals currently supported by LogicSim
         
         /*
@@ -42,19 +148,28 @@ namespace lgs
          *                          all LEDs are printed as <Label><State><Label><State>... in a single line. The label can be a null string to 
          *                          produce the effect of printing two or more states consecutively, as <State><State>...
          *
+         * The text is only formatted when some LED changes, by flipping its state character in place, and is published to the screen at most once
+         * every LGS_LEDARRAY_UPDATE_TIME milliseconds. In headless mode every change is published, to be logged by logPrintSections.
+         *
          * NOTE: Note, multiple LEDArrays are allowed, but because of how adding PrintSections are handled, multiple LEDArrays will appear in an order
          *       relative to themselves that is reverse of the order they appear in the JSON file. Their order with respect to any other PrintSection's
          *       order of appearance is undefined. In general, it is currently difficult to control order within PrintSections in general.
          */
-        class LEDArray : public Peripheral
+        class LEDArray final : public Peripheral
         {
                 private:
-                        std::vector<std::pair<int, int>> led_pos;
-                        std::vector<std::string> led_labels;
+                        std::vector<std::string> led_labels;                    // The i'th LED is bit i % 64 of input lane i / 64.
                         lgs::PrintSection* section;
+                        std::string text;                                       // Text as of the last tick.
+                        std::vector<int> state_index;                           // Index in text of the state of each LED.
+                        std::vector<LaneWord> words;                            // Input lanes as of the last tick.
+                        bool pending;                                           // Text changed since last published.
+                        bool rate_limited;                                      // Not headless.
+                        std::chrono::steady_clock::time_point last_update;
                 public:
                         LEDArray(const nlohmann::json& initJson);
-                        void tick(const bool* stateR, bool* stateW, int w, int h) override;
+                        void tick(const LaneWord* in, LaneWord* out, bool* drive) override;
+                        void finish() override;                                 // Publish the last change.
         };
 
         /*
@@ -71,14 +186,13 @@ namespace lgs
          * NOTE: The class uses ncurses for keyboard input. Only keystrokes visible to ncurses are supported. Also note that currently, keystrokes corresponding
          *       to interrupt signals are ignored by the way ncurses is initialized.
          */
-        class BitSwitchArray : public Peripheral
+        class BitSwitchArray final : public Peripheral
         {
                 private:
-                        std::vector<std::pair<int, int>> switch_pos;
-                        std::vector<int> keys;
+                        std::vector<int> keys;                                  // The i'th switch is bit i % 64 of output lane i / 64.
                 public:
                         BitSwitchArray(const nlohmann::json& initJson);
-                        void tick(const bool* stateR, bool* stateW, int w, int h) override;
+                        void tick(const LaneWord* in, LaneWord* out, bool* drive) override;
         };
 
         /*
@@ -86,23 +200,28 @@ namespace lgs
          * cannot synchronize with real life time, and the other is that the size of the circuit will increase at best as a square root of the time period, making
          * long time period clock circuits extremely large. This peripheral solves both these issues.
          *
-         * JSON Initializer syntax: The JSON initializer has three integer fields, "X" and "Y" representing the position in the circuit to which the clock is
-         *                          connected, and "Period" representing the period in milliseconds of the clock signal produced.
+         * The clock follows the time mode (see timesource.hpp). In real time it toggles once "Period" milliseconds have passed on the steady clock since 
+         * the last toggle. In virtual time, or if the period is given in ticks, it toggles every so many ticks, and is not even ticked in between.
+         *
+         * JSON Initializer syntax: The JSON initializer is a lane (see laneFromJson) locating the bits in the circuit to which the clock is connected, most
+         *                          simply two integer fields "X" and "Y", with an extra positive integer field "Period" representing the period in milliseconds
+         *                          of the clock signal produced, or instead a positive integer field "Period ticks" giving the period in ticks.
          */
-        class Clock : public Peripheral
+        class Clock final : public Peripheral
         {
                 private:
-                        int x, y;
                         std::chrono::steady_clock::duration period;
+                        long int period_ticks;                                  // 0 in real time.
                         bool state;
                         std::chrono::steady_clock::time_point previous;
+                        long int next_toggle;                                   // Tick of the next toggle, if not in real time.
 
 #ifdef LGS_DEBUG
                         unsigned long int ticks = 0;
 #endif
                 public:
                         Clock(const nlohmann::json& initJson);
-                        void tick(const bool* stateR, bool* stateW, int w, int h) override;
+                        void tick(const LaneWord* in, LaneWord* out, bool* drive) override;
         };
 
         /*
@@ -118,20 +237,19 @@ namespace lgs
          * JSON Initializer syntax: The JSON initializer has two fields, "Key pressed line" and "Key code lane". The
          *                          "Key pressed line"'s value is itself a JSON object with two integer valued fields,
          *                          "X" and "Y", locating a bit on the circuit that would be held high if and only if
-         *                          any key is being pressed on the keyboard. The value of the "Key code lane" is an
-         *                          array of length 8. Each element of the array is a JSON object with 2 integer fields,
-         *                          "X" and "Y", and the i'th element locates the bit in the circuit to set with the
-         *                          value of the i'th bit of the keycode when some key is pressed on the keyboard.
+         *                          any key is being pressed on the keyboard. The value of the "Key code lane" is a lane
+         *                          (see laneFromJson), usually of 8 bits, the i'th of which is set with the value of 
+         *                          the i'th bit of the keycode when some key is pressed on the keyboard.
          */
-        class Keyboard : public Peripheral
+        class Keyboard final : public Peripheral
         {
                 private:
-                        int key_pressed_x, key_pressed_y;
-                        std::array<int, 8> key_code_x, key_code_y;
+                        int key_pressed_line;                                   // Output lane index.
+                        int key_code_lane;                                      // Output lane index.
 
                 public:
                         Keyboard(const nlohmann::json& initJson);
-                        void tick(const bool* stateR, bool* stateW, int w, int h) override;
+                        void tick(const LaneWord* in, LaneWord* out, bool* drive) override;
         };
 
         /*
@@ -143,24 +261,205 @@ namespace lgs
          * a 0 from a 1, whatever code is given by the "Character lane", that is printed. To avoid printing burps, or other
          * temporary garbage in the "Character lane", registers and gates should be used. Note that if the code does not
          * correspond to any printable character, undefined behavior occurs. Also note that code 127 is reserved specifically
-         * to denote a backspace character which deletes the last printed character in the same line.
+         * to denote a backspace character which deletes the last printed character in the same line. In headless mode the 
+         * characters go to the output given by initializeHeadlessIO.
          *
          * JSON Initializer syntax: The JSON initializer has two fields, "Print line" and "Character lane". "Print line"
          *                          is a JSON object with two integer fields, "X" and "Y", locating on the circuit the bit
          *                          whose transition from 1 to 0 will cause a character to be printed. "Character lane" is
-         *                          an 8 element array of JSON objects, each with 2 integer fields, "X" and "Y". The i'th
-         *                          element of the array locates the point on the board from where the i'th bit of the 
-         *                          character code is to be read during printing.
+         *                          a lane (see laneFromJson) of 8 bits, the i'th of which is the point on the board from 
+         *                          where the i'th bit of the character code is to be read during printing.
          */
-        class CharStreamPrinter : public Peripheral
+        class CharStreamPrinter final : public ProcessPeripheral
         {
                 private:
-                        int print_line_x, print_line_y;
-                        bool print_line_prev;
-                        std::array<int, 8> char_lane_x, char_lane_y;
+                        int print_line;                                         // Input lane index.
+                        int char_lane;                                          // Input lane index.
+                protected:
+                        void run() override;
                 public:
                         CharStreamPrinter(const nlohmann::json& initJson);
-                        void tick(const bool* stateR, bool* stateW, int w, int h) override;
+        };
+
+        /*
+         * A memory attached to the board, so that ROMs and RAMs need not be built out of logic elements. The memory has one word for 
+         * every value of the "Address lane", each word as wide as the "Data out lane", stored little endian in whole bytes. Every
+         * tick the "Data out lane" is driven with the word at the current address. A RAM also has a "Data in lane" and a "Write
+         * line", and on a rising edge of the write line, that is, a transition from 0 to 1, the value of the data in lane is stored
+         * at the current address, and is visible on the data out lane in the same tick. Address and data in must be stable at the 
+         * edge, so registers should be used as for CharStreamPrinter. The memory is only ticked when its address or write line 
+         * change.
+         *
+         * The memory is backed by a file, mapped into memory rather than read. A ROM maps the file read only, and words past the end
+         * of the file read as 0. A RAM starts with the contents of the file, or with all 0s if it does not exist, and unless the 
+         * memory is persistent its writes are lost at the end of the run. The file of a persistent RAM is extended to the size of
+         * the memory if shorter, and mapped shared, so writes reach the file even if the run is interrupted.
+         *
+         * JSON Initializer syntax: The JSON initializer has the fields "Address lane" and "Data out lane", both lanes (see 
+         *                          laneFromJson), with the address lane at most LGS_MEMORY_MAX_ADDRESS_BITS bits wide, and a string
+         *                          field "File" with the path, relative to the working directory, of the backing file. The optional
+         *                          boolean field "Writable", false by default, makes the memory a RAM, which then also needs the 
+         *                          field "Data in lane", a lane as wide as the data out lane, and "Write line", a JSON object with
+         *                          two integer fields "X" and "Y". The optional boolean field "Persistent", false by default, makes
+         *                          the writes of a RAM persist in the file.
+         */
+        class Memory final : public Peripheral
+        {
+                private:
+                        int address_lane;                                       // Input lane index.
+                        int data_in_lane;                                       // Input lane index, -1 for a ROM.
+                        int write_line;                                         // Input lane index, -1 for a ROM.
+                        int data_out_lane;                                      // Output lane index.
+                        int word_bytes;
+                        LaneWord address_mask;
+                        LaneWord data_mask;
+                        bool write_prev;
+                        unsigned char* data;                                    // The mapped memory.
+                        std::size_t data_size;                                  // Bytes mapped, less than the memory size for a short ROM.
+                        std::size_t map_size;
+                public:
+                        Memory(const nlohmann::json& initJson);
+                        Memory(Memory&& other);
+                        ~Memory();
+                        void tick(const LaneWord* in, LaneWord* out, bool* drive) override;
+        };
+
+        /*
+         * A peripheral that streams the bytes of a file into the circuit, one byte at a time. While a byte is available it is driven on
+         * the "Data lane" and the "Valid line" is held high. The circuit takes the byte with a falling edge on the "Next line", like 
+         * the print line of CharStreamPrinter, after which the next byte is driven as soon as it is available. While no byte is 
+         * available the valid line is low and the data lane is 0, and once the whole file has been read the optional "End line" goes 
+         * high. The file is read ahead into a large buffer on a background thread, so the circuit is never held up by the disk.
+         *
+         * JSON Initializer syntax: The JSON initializer has a string field "File" with the path of the file relative to the working
+         *                          directory, a field "Data lane", a lane (see laneFromJson) of usually 8 bits, and fields "Valid
+         *                          line", "Next line" and optionally "End line", each a JSON object with two integer fields "X" and "Y".
+         */
+        class FileReader final : public Peripheral
+        {
+                private:
+                        int data_lane;                                          // Output lane index.
+                        int valid_line;                                         // Output lane index.
+                        int end_line;                                           // Output lane index, -1 if none.
+                        int next_line;                                          // Input lane index.
+                        bool next_prev;
+                        bool has_byte;
+                        unsigned char byte;
+                        FileStream* stream;
+                public:
+                        FileReader(const nlohmann::json& initJson);
+                        FileReader(FileReader&& other);
+                        ~FileReader();
+                        void tick(const LaneWord* in, LaneWord* out, bool* drive) override;
+        };
+
+        /*
+         * A peripheral that streams bytes from the circuit into a file. On a falling edge of the "Write line" the low 8 bits of the 
+         * "Data lane" are appended to the file, like CharStreamPrinter prints them. The optional "Ready line" is held high while the
+         * buffer can take a byte. With a Ready line, writing a byte while it is low ends the run with an error. Without one, bytes 
+         * written while the buffer is full are not lost, but hold up the simulation until the background thread has written out 
+         * some of the buffer. A failure to write the file also ends the run with an error. The file is truncated when the run starts.
+         *
+         * JSON Initializer syntax: The JSON initializer has a string field "File" with the path of the file relative to the working
+         *                          directory, a field "Data lane", a lane (see laneFromJson) of usually 8 bits, and fields "Write
+         *                          line" and optionally "Ready line", each a JSON object with two integer fields "X" and "Y".
+         */
+        class FileWriter final : public Peripheral
+        {
+                private:
+                        int data_lane;                                          // Input lane index.
+                        int write_line;                                         // Input lane index.
+                        int ready_line;                                         // Output lane index, -1 if none.
+                        bool write_prev;
+                        FileStream* stream;
+                public:
+                        FileWriter(const nlohmann::json& initJson);
+                        FileWriter(FileWriter&& other);
+                        ~FileWriter();
+                        void tick(const LaneWord* in, LaneWord* out, bool* drive) override;
+                        void finish() override;
+        };
+
+        /*
+         * A peripheral that shows part of the board as a display, and streams it to a file as a video, so that circuits driving 
+         * displays can be watched without encoding the whole board into the output gif. Every "Period" ticks the display reads its
+         * pixels and appends a frame to the file as a binary PPM image. The file is a stream of PPM images that can be played or 
+         * converted as is, for example with ffmpeg -f image2pipe -i <file> <video>. The display is only ticked when a frame is due,
+         * and in between its pixels are not even gathered from the board.
+         *
+         * Each pixel is "Bits per pixel" adjacent bits of a row, the first being the least significant, whose value indexes the
+         * "Palette". The display is either a rectangle of the board, in which case the bits of a row are cells left to right, or an
+         * array of lanes addressed like video memory, one lane per row.
+         *
+         * JSON Initializer syntax: The JSON initializer has a string field "File" with the path of the file relative to the working
+         *                          directory, and either a field "Region", a JSON object with integer fields "X", "Y", "Width" and
+         *                          "Height", or a field "Rows", an array of lanes (see laneFromJson) all of the same length. The
+         *                          optional integer fields are "Period", the ticks between frames, 1 by default, "Scale", the side
+         *                          in image pixels of a display pixel, 1 by default, and "Bits per pixel", which is 1, 2, 4 or 8, 1 by
+         *                          default. The optional field "Palette" is an array of 2^"Bits per pixel" arrays of 3 integers, 
+         *                          the red, green and blue of each pixel value, by default from black for 0 to white for all 1s.
+         */
+        class Display final : public Peripheral
+        {
+                private:
+                        int width, height;                                      // In display pixels.
+                        int lanes_per_row;
+                        int bits_per_pixel;
+                        int period;
+                        int scale;
+                        std::vector<unsigned char> palette;                     // RGB of each pixel value.
+                        std::vector<unsigned char> frame;                       // PPM header followed by the image.
+                        std::size_t header_size;
+                        FileStream* stream;
+                public:
+                        Display(const nlohmann::json& initJson);
+                        Display(Display&& other);
+                        ~Display();
+                        void tick(const LaneWord* in, LaneWord* out, bool* drive) override;
+                        void finish() override;
+        };
+
+        /*
+         * A peripheral connecting a UART in the circuit to another process, through a Unix domain socket or a pseudo terminal (see
+         * SerialLink), so that external programs can talk to the simulated design. Bytes are framed as 8N1: the line idles high, 
+         * and a byte is a 0 start bit, 8 data bits least significant first, and a 1 stop bit, each bit held for "Ticks per bit"
+         * ticks. Bytes the circuit sends on the "TX line" are sampled in the middle of each bit and sent to the other process,
+         * and bytes without a valid stop bit are dropped. Bytes from the other process are sent to the circuit on the "RX line". 
+         * The simulation never waits on the other process: bytes from the circuit are dropped if the link's buffer is full.
+         *
+         * With a "Log" file, every byte is logged on a line of its own as "<tick> in <byte>" when its start bit is driven on the RX 
+         * line, or "<tick> out <byte>" when its stop bit is sampled on the TX line, so round trip latencies through the design can be 
+         * measured in ticks.
+         *
+         * JSON Initializer syntax: The JSON initializer has fields "TX line" and "RX line", each a JSON object with two integer fields
+         *                          "X" and "Y", and an integer field "Ticks per bit", at least 2. The string field "Socket" gives
+         *                          the path of the socket to listen on. Without it a pseudo terminal is opened, and its name is
+         *                          printed. The optional string field "Log" gives the path of the log file. Paths are relative to
+         *                          the working directory.
+         */
+        class SerialPort final : public Peripheral
+        {
+                private:
+                        int tx_line;                                            // Input lane index.
+                        int rx_line;                                            // Output lane index.
+                        int ticks_per_bit;
+                        bool tx_prev;
+                        int recv_bit;                                           // Bit of the byte being received, -1 if idle.
+                        unsigned char recv_byte;
+                        long int recv_next;                                     // Tick to sample the next bit at.
+                        int send_bit;                                           // 0 for start, 1 to 8 for data, 9 for stop, -1 if idle.
+                        unsigned char send_byte;
+                        long int send_next;                                     // Tick to drive the next bit at.
+                        SerialLink* link;
+                        FileStream* log;                                        // NULL if not logging.
+
+                        void log_byte(const char* direction, unsigned char byte);
+                public:
+                        SerialPort(const nlohmann::json& initJson);
+                        SerialPort(SerialPort&& other);
+                        ~SerialPort();
+                        void tick(const LaneWord* in, LaneWord* out, bool* drive) override;
+                        void finish() override;
         };
 
         /*
@@ -168,6 +467,59 @@ namespace lgs
          */
         Peripheral* peripheralFromJson(const nlohmann::json& initJson);
 
+        /*
+         * The peripherals attached to a board. The peripheral classes above are stored by value in one contiguous vector per class,
+         * and ticked class by class with direct calls that the compiler can inline, since the classes are final. Peripherals of other 
+         * classes are kept by pointer and ticked with virtual calls. The set owns all its peripherals.
+         *
+         * JSON initializer syntax: The "Peripherals" array of the system JSON, see peripheralFromJson.
+         */
+        class PeripheralSet
+        {
+                private:
+                        /*
+                         * The peripherals of one class, with the position of each in the set.
+                         */
+                        template<class T> struct Batch
+                        {
+                                std::vector<T> peripherals;
+                                std::vector<int> index;
+                        };
+
+                        Batch<LEDArray> led_arrays;
+                        Batch<BitSwitchArray> bit_switch_arrays;
+                        Batch<Clock> clocks;
+                        Batch<Keyboard> keyboards;
+                        Batch<CharStreamPrinter> char_stream_printers;
+                        Batch<Memory> memories;
+                        Batch<FileReader> file_readers;
+                        Batch<FileWriter> file_writers;
+                        Batch<Display> displays;
+                        Batch<SerialPort> serial_ports;
+                        Batch<Peripheral*> others;
+                        std::vector<Peripheral*> all;                           // All peripherals, in order of the JSON.
+
+                        template<class T> void add(Batch<T>& batch, const nlohmann::json& initJson);
+                        template<class T> void tick_batch(Batch<T>& batch, const char* due, long int tickNumber, const LaneWord* in, 
+                                        LaneWord* out, bool* drive, const int* inputBase, const int* outputBase, int* wake);
+                public:
+                        PeripheralSet(const nlohmann::json& peripheralsJson);
+                        PeripheralSet(const PeripheralSet&) = delete;
+                        PeripheralSet& operator=(const PeripheralSet&) = delete;
+                        ~PeripheralSet();
+
+                        void addPeripheral(Peripheral* peripheral);             // Add a peripheral of any class, taking ownership.
+                        const std::vector<Peripheral*>& getPeripherals() const;
+                        void finish();                                          // Finish every peripheral, after the last tick, and report errors.
+
+                        /*
+                         * Tick the peripherals p for which due[p] is true, in class batches, as tick number tickNumber. The lanes of 
+                         * peripheral p start at in + inputBase[p] and out + outputBase[p], and its wake request is stored in wake[p].
+                         */
+                        void tick(const char* due, long int tickNumber, const LaneWord* in, LaneWord* out, bool* drive, 
+                                        const int* inputBase, const int* outputBase, int* wake);
+        };
+
 }
 
 #endif
@@ -0,0 +1,50 @@
+/*
+ * Connects the simulation thread to a Unix domain socket or a pseudo terminal, with all io done on a background thread.
+ */
+
+#ifndef LGS_INCLUDE_SERIAL_LINK
+#define LGS_INCLUDE_SERIAL_LINK
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#include <spscqueue.hpp>
+
+namespace lgs
+{
+        /*
+         * A byte stream between the simulation and another process. With a socket path the link listens on a Unix domain socket at 
+         * that path and serves one client at a time, accepting the next once it disconnects. With an empty path the link opens a
+         * pseudo terminal in raw mode, whose name is given by getName(). The background thread moves bytes between the file 
+         * descriptor and two queues in batches, using non blocking io and poll(), so the simulation thread never waits on it.
+         */
+        class SerialLink
+        {
+                private:
+                        SPSCQueue<unsigned char> to_board;              // Bytes from the other process.
+                        SPSCQueue<unsigned char> from_board;            // Bytes for the other process.
+                        std::vector<unsigned char> pending;             // Bytes popped from from_board not yet written.
+                        std::string name;
+                        int listen_fd;                                  // Listening socket, -1 for a pseudo terminal.
+                        int fd;                                         // Connection, -1 if none.
+                        int pty_slave_fd;                               // Kept open so the terminal stays up, -1 for a socket.
+                        std::atomic<bool> closing;
+                        std::thread worker;
+
+                        void run();                                     // Background thread main loop.
+                        void transfer(bool readable, bool writable);    // Move what can be moved without blocking.
+                        void disconnect();                              // Drop a socket peer that went away, and accept again.
+                public:
+                        SerialLink(const std::string& socketPath);
+                        ~SerialLink();
+
+                        const std::string& getName() const;             // Socket path or pseudo terminal device.
+                        bool receive(unsigned char& byte);              // False if no byte has arrived.
+                        bool send(unsigned char byte);                  // False if the buffer is full, the byte is then dropped.
+                        void close();                                   // Stop the thread and close, may be called more than once.
+        };
+}
+
+#endif
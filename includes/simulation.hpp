@@ -0,0 +1,140 @@
+/*
+ * File containing the frontend side of a tick: drives an engine and ticks the peripherals attached to the board.
+ */
+
+#ifndef LGS_INCLUDE_SIMULATION
+#define LGS_INCLUDE_SIMULATION
+
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#include <lane.hpp>
+
+#ifdef LGS_PROFILE
+#include <chrono>
+#endif
+
+namespace lgs
+{
+        // Forward declaration
+        class Engine;
+        class PeripheralSet;
+#ifdef LGS_PROFILE
+        class PrintSection;
+#endif
+
+        /*
+         * Runs a system, that is, an engine loaded with a circuit together with the peripherals attached to it. Does not own either.
+         *
+         * The input lanes of all peripherals are gathered by the engine into one buffer of words, and all output lanes are scattered
+         * back from one buffer in one pass, each peripheral seeing its own lanes at an offset into these buffers. Lanes are scattered
+         * in the order of the peripherals, so of two peripherals driving the same bit the later one wins. Peripherals watching lanes
+         * are only ticked when the XOR of the watched words with their values at the previous tick is non zero, or when their wake
+         * request is due, so the cost of quiet peripherals is a few word compares instead of a virtual call. In the synchronous mode
+         * the lanes such a peripheral does not watch are only gathered on the ticks it is ticked, so a peripheral sampling a large 
+         * part of the board every so many ticks does not cost a gather every tick.
+         *
+         * By default peripherals are ticked on the simulation thread: in every tick they read the current state and their writes go
+         * into the next state. With a pipeline depth d > 0 they are instead ticked on a peripheral thread, in the same order, while 
+         * the simulation thread carries on with the logic. The tick semantics are then as follows. At tick t the simulation thread 
+         * hands the input lanes gathered from state t to the peripheral thread, which ticks the peripherals on them, so reading 
+         * peripherals see exactly what they would see otherwise. The output lanes and drive flags are handed back and scattered to
+         * state t+d+1, that is, writes take effect d ticks later than in the synchronous mode. The simulation thread only waits when
+         * the peripheral thread falls d ticks behind. Handoffs go through a ring of d+1 slots synchronised by atomic tick stamps.
+         */
+        class Simulation
+        {
+                private:
+                        /*
+                         * One slot of the handoff ring. inputs holds the input lanes gathered from state published, outputs and drive
+                         * hold what the peripherals wrote on them, valid once done equals published.
+                         */
+                        struct PipelineSlot
+                        {
+                                LaneWord* inputs;
+                                LaneWord* outputs;
+                                bool* drive;
+                                std::atomic<long int> published;
+                                std::atomic<long int> done;
+                        };
+
+                        Engine* engine;
+                        PeripheralSet& peripherals;
+                        const int width;
+                        const int height;
+                        const int pipeline_depth;
+                        long int n_ticks;
+                        LaneSet input_lanes;                                    // Input lanes of all peripherals, in order.
+                        LaneSet output_lanes;                                   // Output lanes of all peripherals, in order.
+                        std::vector<int> input_base;                            // Index of the first input lane of each peripheral, and the end.
+                        std::vector<int> output_base;                           // Index of the first output lane of each peripheral, and the end.
+                        std::vector<int> watch_lanes;                           // Watched input lanes of all peripherals, in order.
+                        std::vector<int> watch_begins;                          // Index into watch_lanes of the first of each peripheral.
+                        std::vector<char> polling;                              // Peripherals ticked every tick.
+                        std::vector<char> watching_keys;                        // Peripherals ticked when a key goes down or up.
+                        int n_polling;
+                        int n_watching_keys;
+                        long int n_skipped;                                     // Ticks skipped by skipTicks().
+                        std::vector<long int> wake_tick;                        // Tick each peripheral asked to be woken at, -1 if none.
+                        LaneSet eager_lanes;                                    // Input lanes gathered every tick.
+                        std::vector<int> eager_index;                           // Index of each eager lane among all input lanes.
+                        std::vector<LaneSet> lazy_lanes;                        // Input lanes of each peripheral gathered only when due.
+                        std::vector<std::vector<int>> lazy_index;
+                        int max_lazy;                                           // Most lazy lanes of one peripheral, 0 if all are eager.
+                        LaneWord* eager_words;
+                        LaneWord* lazy_words;
+                        std::vector<char> due;                                  // Peripherals to tick this tick.
+                        std::vector<int> wake;                                  // Wake requests made this tick.
+                        long int peripheral_ticks;                              // Ticks done by the peripherals.
+                        long int log_step;                                      // Peripheral ticks between logs of the print sections, 0 for none.
+                        LaneWord* in_words;                                     // Input lanes of the synchronous mode.
+                        LaneWord* prev_in_words;                                // Input lanes at the last peripheral tick.
+                        LaneWord* out_words;                                    // Output lanes as last written by each peripheral.
+                        bool* drive;
+                        PipelineSlot* slots;                                    // Handoff ring of pipeline_depth + 1 slots.
+                        std::atomic<bool> stopping;                             // Set once no more snapshots will be published.
+                        std::atomic<bool> failed;                               // Set by the peripheral thread once a peripheral failed.
+                        std::thread peripheral_thread;
+
+                        void tick_peripherals(LaneWord* in, bool gatherLazy);   // Tick the peripherals due, into out_words and drive.
+                        void run_peripherals();                                 // Peripheral thread main loop.
+                        bool check_errors();                                    // True if a due peripheral failed in the last peripheral tick.
+                        void report_errors();                                   // Prints the errors of the peripherals and exits, on the main thread.
+#ifdef LGS_PROFILE
+                        int profile_n_ticks;
+                        std::chrono::steady_clock::duration profile_time_logic;
+                        std::chrono::steady_clock::duration profile_time_peripherals;
+                        PrintSection* prof_sec;
+#endif 
+
+                public:
+                        Simulation(Engine* eng, const int w, const int h, PeripheralSet& ps, const int pipelineDepth);
+                        ~Simulation();
+
+                        void tickSimulation();                                  // Simulate one step
+
+                        /*
+                         * Returns the number of ticks from now that would change nothing, up to the tick the first peripheral is due to 
+                         * wake, or LONG_MAX if none is. That is 0 unless the engine is stable, no peripheral polls or is due to wake now, 
+                         * and no key event is pending for peripherals watching keys. Skipping that many ticks or fewer with skipTicks() 
+                         * has the same effect as ticking them without doing any work, unless a key event comes in meanwhile. Always 0 in 
+                         * pipelined mode.
+                         */
+                        long int getIdleTicks();
+                        void skipTicks(long int n);
+                        bool isWatchingKeys();                                  // True if some peripheral is ticked on key events.
+
+                        /*
+                         * Logs the print sections with logPrintSections every step ticks, from the thread ticking the peripherals, so
+                         * that in pipelined mode the log is stamped with the tick the peripherals reached and not that of the logic.
+                         */
+                        void setLogStep(long int step);
+                        long int getSkippedTicks();
+                        void setEngine(Engine* eng);                            // Swaps in an engine holding the same state, between ticks.
+                        const bool* getState();                                 // Returns current(last) state.
+                        void drain();                                           // Waits for the peripheral thread to tick all snapshots and stops it.
+        };
+}
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * A bounded lock free queue between exactly one producer thread and one consumer thread.
+ */
+
+#ifndef LGS_INCLUDE_SPSC_QUEUE
+#define LGS_INCLUDE_SPSC_QUEUE
+
+#include <atomic>
+#include <cstddef>
+
+namespace lgs
+{
+        /*
+         * A ring of items, with a capacity rounded up to a power of 2. Only the producer may push and only the consumer may pop. Each 
+         * side owns one index and only reads the other's, so neither ever waits. The indices grow without wrapping the ring, and are
+         * kept on separate cache lines.
+         */
+        template<class T> class SPSCQueue
+        {
+                private:
+                        T* items;
+                        std::size_t mask;
+                        std::atomic<std::size_t> head;                  // Index of the next item to pop.
+                        char pad[64];
+                        std::atomic<std::size_t> tail;                  // Index of the next item to push.
+
+                public:
+                        SPSCQueue(std::size_t capacity);
+                        ~SPSCQueue();
+                        SPSCQueue(const SPSCQueue&) = delete;
+                        SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+                        bool push(const T& item);                               // False if full.
+                        bool pop(T& item);                                      // False if empty.
+                        std::size_t pushSome(const T* src, std::size_t n);      // Push up to n items, returns the number pushed.
+                        std::size_t popSome(T* dst, std::size_t n);             // Pop up to n items, returns the number popped.
+                        std::size_t size() const;
+                        std::size_t capacity() const;
+        };
+}
+
+template<class T> lgs::SPSCQueue<T>::SPSCQueue(std::size_t capacity) : head(0), tail(0)
+{
+        std::size_t n = 1;
+        while(n < capacity) n *= 2;
+        items = new T[n];
+        mask = n - 1;
+}
+
+template<class T> lgs::SPSCQueue<T>::~SPSCQueue() { delete[] items; }
+
+template<class T> bool lgs::SPSCQueue<T>::push(const T& item)
+{
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        if(t - head.load(std::memory_order_acquire) > mask) return false;
+        items[t & mask] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+}
+
+template<class T> bool lgs::SPSCQueue<T>::pop(T& item)
+{
+        std::size_t h = head.load(std::memory_order_relaxed);
+        if(h == tail.load(std::memory_order_acquire)) return false;
+        item = items[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+}
+
+template<class T> std::size_t lgs::SPSCQueue<T>::pushSome(const T* src, std::size_t n)
+{
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        std::size_t space = mask + 1 - (t - head.load(std::memory_order_acquire));
+        if(n > space) n = space;
+        for(std::size_t i = 0; i < n; i++)
+                items[(t + i) & mask] = src[i];
+        tail.store(t + n, std::memory_order_release);
+        return n;
+}
+
+template<class T> std::size_t lgs::SPSCQueue<T>::popSome(T* dst, std::size_t n)
+{
+        std::size_t h = head.load(std::memory_order_relaxed);
+        std::size_t available = tail.load(std::memory_order_acquire) - h;
+        if(n > available) n = available;
+        for(std::size_t i = 0; i < n; i++)
+                dst[i] = items[(h + i) & mask];
+        head.store(h + n, std::memory_order_release);
+        return n;
+}
+
+template<class T> std::size_t lgs::SPSCQueue<T>::size() const
+{
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+}
+
+template<class T> std::size_t lgs::SPSCQueue<T>::capacity() const { return mask + 1; }
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * The notion of time used by peripherals that measure time, like Clock.
+ */
+
+#ifndef LGS_INCLUDE_TIME_SOURCE
+#define LGS_INCLUDE_TIME_SOURCE
+
+namespace lgs
+{
+        /*
+         * In TIME_REAL mode periods in milliseconds are measured on the steady clock, so that peripherals keep pace with the real 
+         * world, at the price of runs that depend on how fast the machine is. In TIME_VIRTUAL mode periods are measured in ticks, a 
+         * virtual millisecond being a fixed number of ticks, so that runs are reproducible and the engine is free to run as fast as 
+         * it can.
+         */
+        enum TimeMode { TIME_REAL, TIME_VIRTUAL };
+
+        /*
+         * Sets the time mode, and for virtual time the ticks per virtual millisecond. Must be called before peripherals are made.
+         */
+        void setTimeMode(TimeMode mode, double ticksPerMillisecond);
+
+        /*
+         * Returns the time mode, TIME_REAL unless set otherwise.
+         */
+        TimeMode getTimeMode();
+
+        /*
+         * Converts virtual milliseconds to ticks, rounding to the nearest tick but never below 1.
+         */
+        long int virtualMillisecondsToTicks(double milliseconds);
+}
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * Implementation for autotune.hpp
+ */
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include <json.hpp>
+
+#include <engine.hpp>
+#include <logicsim.hpp>
+
+#include <autotune.hpp>
+
+namespace
+{
+        /*
+         * FNV-1a hash of the circuit dimensions and data, as a hex string.
+         */
+        std::string circuit_hash(const unsigned int* crd, int w, int h)
+        {
+                unsigned long long int hash = 14695981039346656037ULL;
+                std::vector<unsigned int> words(crd, crd + w*h);
+                words.push_back(w);
+                words.push_back(h);
+                for(std::vector<unsigned int>::const_iterator i = words.begin(); i != words.end(); ++i)
+                        for(int b = 0; b < 4; b++)
+                        {
+                                hash ^= (*i >> (8*b)) & 255;
+                                hash *= 1099511628211ULL;
+                        }
+                std::stringstream str;
+                str << std::hex << hash;
+                return str.str();
+        }
+
+        /*
+         * The CPU model as reported by /proc/cpuinfo, or "unknown" where that is unavailable.
+         */
+        std::string cpu_model()
+        {
+                std::ifstream cpuinfo("/proc/cpuinfo");
+                std::string line;
+                while(std::getline(cpuinfo, line))
+                        if(line.compare(0, 10, "model name") == 0)
+                        {
+                                std::size_t i = line.find(':');
+                                if(i != std::string::npos && i + 2 <= line.size()) return line.substr(i + 2);
+                        }
+                return std::string("unknown");
+        }
+
+        /*
+         * The cache file as a JSON object, empty if it is missing or is not a JSON object.
+         */
+        nlohmann::json read_cache(const std::string& cachePath)
+        {
+                nlohmann::json cache = nlohmann::json::object();
+                std::ifstream cache_file(cachePath.c_str());
+                if(cache_file.is_open())
+                {
+                        try { cache_file >> cache; }
+                        catch(nlohmann::json::exception& e) { cache = nlohmann::json::object(); }
+                        cache_file.close();
+                }
+                if(!cache.is_object()) cache = nlohmann::json::object();
+                return cache;
+        }
+
+        /*
+         * One tick of the engine, with the driven cells held at their values in state.
+         */
+        void tick_held(lgs::Engine* engine, const std::vector<int>& drivenCells, const bool* state)
+        {
+                engine->evaluate();
+                bool* next = engine->getNextState();
+                for(std::vector<int>::const_iterator c = drivenCells.begin(); c != drivenCells.end(); ++c)
+                        next[*c] = state[*c];
+                engine->commit();
+        }
+
+        /*
+         * Simulated ticks per second with the given choice, from the given state.
+         */
+        double benchmark(const lgs::TuneChoice& choice, const unsigned int* crd, int w, int h, const lgs::EngineOptions& runOptions,
+                        const bool* state)
+        {
+                lgs::EngineOptions options = runOptions;
+                options.tile_size = choice.tile_size;
+                options.state = state;
+                lgs::Engine* engine = lgs::engineFromName(choice.engine, crd, w, h, options);
+                std::vector<int> driven_cells;
+                for(std::vector<std::pair<int, int>>::const_iterator p = options.driven.begin(); p != options.driven.end(); ++p)
+                        if(0 <= p->first && p->first < w && 0 <= p->second && p->second < h)
+                                driven_cells.push_back(p->second*w + p->first);
+                for(int i = 0; i < LGS_AUTOTUNE_WARMUP_TICKS; i++)
+                        tick_held(engine, driven_cells, state);
+
+                std::chrono::steady_clock::duration trial = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                std::chrono::milliseconds(LGS_AUTOTUNE_TRIAL_TIME));
+                std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now(), t1 = t0;
+                long int n = 0;
+                while(t1 - t0 < trial)
+                {
+                        tick_held(engine, driven_cells, state);
+                        ++n;
+                        t1 = std::chrono::steady_clock::now();
+                }
+                delete engine;
+                return n / std::chrono::duration<double>(t1 - t0).count();
+        }
+}
+
+bool lgs::cachedTuneChoice(const unsigned int* crd, int w, int h, const std::string& cachePath, TuneChoice& choice)
+{
+        nlohmann::json cache = read_cache(cachePath);
+        try
+        {
+                const nlohmann::json& entry = cache.at(circuit_hash(crd, w, h)).at(cpu_model());
+                if(!entry.at("Engine").is_string() || !entry.at("Tile size").is_number_integer()) return false;
+                choice.engine = entry.at("Engine").get<std::string>();
+                choice.tile_size = entry.at("Tile size").get<int>();
+        }
+        catch(nlohmann::json::exception& e)
+        {
+                return false;
+        }
+        return (choice.engine == std::string("dense") || choice.engine == std::string("regions")) && choice.tile_size > 0;
+}
+
+lgs::TuneChoice lgs::autotune(const unsigned int* crd, int w, int h, const EngineOptions& options, const bool* state, 
+                const std::string& cachePath)
+{
+        std::vector<TuneChoice> candidates;
+        TuneChoice dense = {std::string("dense"), LGS_REGION_TILE_SIZE};
+        candidates.push_back(dense);
+        for(int tile = 16; tile <= 128; tile *= 2)
+        {
+                TuneChoice tiled = {std::string("regions"), tile};
+                candidates.push_back(tiled);
+        }
+
+        TuneChoice best;
+        double best_rate = -1;
+        for(std::vector<TuneChoice>::const_iterator c = candidates.begin(); c != candidates.end(); ++c)
+        {
+                double rate = benchmark(*c, crd, w, h, options, state);
+                if(rate > best_rate)
+                {
+                        best_rate = rate;
+                        best = *c;
+                }
+        }
+
+        // Replace whatever malformed entry is in the way
+        nlohmann::json cache = read_cache(cachePath);
+        std::string hash = circuit_hash(crd, w, h);
+        std::string cpu = cpu_model();
+        if(!cache[hash].is_object()) cache[hash] = nlohmann::json::object();
+        cache[hash][cpu] = nlohmann::json::object();
+        cache[hash][cpu]["Engine"] = best.engine;
+        cache[hash][cpu]["Tile size"] = best.tile_size;
+        cache[hash][cpu]["Ticks per second"] = best_rate;
+        std::ofstream out_file(cachePath.c_str());
+        if(out_file.is_open()) out_file << cache.dump(8) << std::endl;
+        return best;
+}
+
+std::string lgs::defaultAutotuneCachePath()
+{
+        const char* home = std::getenv("HOME");
+        return (home != NULL ? std::string(home) + std::string("/") : std::string("")) + std::string(LGS_AUTOTUNE_CACHE_FILE);
+}
@@ -3,22 +3,49 @@
  */
 
 #include <vector>
-
-#include <peripherals.hpp>
-#include <logicsim.hpp>
-
-#ifdef LGS_PROFILE
-#include <chrono>
+#include <utility>
+#include <algorithm>
 #include <string>
 #include <sstream>
-#include <ncursesio.hpp>
-#endif
+#include <cstring>
+
+#include <logicsim.hpp>
 
 #include <cpuworker.hpp>
 
-lgs::CPUWorker::CPUWorker(const unsigned int* crd, const int w, const int h, const std::vector<Peripheral*>& ps)
-        : circuit_data(crd), width(w), height(h), peripherals(ps)
+lgs::CPUWorker::CPUWorker(const std::vector<std::pair<int, int>>& drivenPins)
+        : circuit_data(NULL), width(0), height(0), state_r(NULL), state_w(NULL), driven(drivenPins), cone_mask(NULL), 
+          known_r(NULL), known_w(NULL), cell_kernel(NULL), dirty(NULL), activity_primed(false), n_ticks(0), settle_tick(-1),
+          n_cone_cells(-1), n_active_cells(-1)
+{
+}
+
+lgs::CPUWorker::~CPUWorker()
+{
+        delete[] state_r;
+        delete[] state_w;
+        delete[] cone_mask;
+        delete[] known_r;
+        delete[] known_w;
+        delete[] cell_kernel;
+        delete[] dirty;
+}
+
+void lgs::CPUWorker::loadCircuit(const unsigned int* crd, int w, int h)
 {
+        delete[] state_r;
+        delete[] state_w;
+        delete[] cone_mask;
+        delete[] known_r;
+        delete[] known_w;
+        delete[] cell_kernel;
+        delete[] dirty;
+        cone_mask = known_r = known_w = dirty = NULL;
+        cell_kernel = NULL;
+
+        circuit_data = crd;
+        width = w;
+        height = h;
         state_r = new bool[w*h];
         state_w = new bool[w*h];
         for(int i = 0; i < w*h; i++)
@@ -26,81 +53,422 @@ lgs::CPUWorker::CPUWorker(const unsigned int* crd, const int w, const int h, con
                 state_r[i] = false;
                 state_w[i] = false;
         }
-#ifdef LGS_PROFILE
-        prof_sec = new lgs::PrintSection();
-#endif
+        driven_cells.clear();
+        for(std::vector<std::pair<int, int>>::const_iterator p = driven.begin(); p != driven.end(); ++p)
+                if(0 <= p->first && p->first < width && 0 <= p->second && p->second < height)
+                        driven_cells.push_back(p->second*width + p->first);
+        n_ticks = 0;
+        settle_tick = -1;
+        n_cone_cells = -1;
+        n_active_cells = -1;
 }
 
-lgs::CPUWorker::~CPUWorker()
+void lgs::CPUWorker::loadState(const bool* state)
 {
-        delete[] state_r;
-        delete[] state_w;
-#ifdef LGS_PROFILE
-        delete prof_sec;
-#endif
+        for(int i = 0; i < width*height; i++)
+        {
+                state_r[i] = state[i];
+                state_w[i] = state[i];
+        }
+}
+
+inline int lgs::CPUWorker::input_index(int x, int y, int i) const
+{
+        unsigned int c = (circuit_data[y*width + x]>>(16+i)) % 2;
+        switch(i)
+        {
+                case 0: x = x + 1 + c; break;
+                case 1: y = y - 1 - c; break;
+                case 2: x = x - 1 - c; break;
+                default: y = y + 1 + c; break;
+        }
+        return (0 <= x && x < width && 0 <= y && y < height) ? y*width + x : -1;
+}
+
+inline bool lgs::CPUWorker::eval_cell(const bool* state_r, int x, int y) const
+{
+        int x0 = x + 1 + ((circuit_data[y*width+x]>>16) % 2);
+        int y1 = y - 1 - ((circuit_data[y*width+x]>>17) % 2);
+        int x2 = x - 1 - ((circuit_data[y*width+x]>>18) % 2);
+        int y3 = y + 1 + ((circuit_data[y*width+x]>>19) % 2);
+        bool a0 = x0 < width ? state_r[y*width + x0] : false;
+        bool a1 = y1 >= 0 ? state_r[y1*width + x] : false;
+        bool a2 = x2 >= 0 ? state_r[y*width + x2] : false;
+        bool a3 = y3 < height ? state_r[y3*width + x] : false;
+        int ws = a3 ? circuit_data[y*width + x] / 256 : circuit_data[y*width + x];
+        ws = a2 ? ws / 16 : ws;
+        ws = a1 ? ws / 4 : ws;
+        ws = a0 ? ws / 2 : ws;
+        return ws % 2 == 1;
+}
+
+namespace
+{
+        /*
+         * For each mask k of known input bits and input values v, the set of truth table entries that agree with the known inputs. 
+         * A logic element's output is known iff its truth table is constant over that set.
+         */
+        struct XMatchTable
+        {
+                unsigned int m[16][16];
+                XMatchTable()
+                {
+                        for(int k = 0; k < 16; k++)
+                                for(int v = 0; v < 16; v++)
+                                {
+                                        m[k][v] = 0;
+                                        for(int a = 0; a < 16; a++)
+                                                if((a & k) == (v & k)) m[k][v] |= 1u << a;
+                                }
+                }
+        };
+        const XMatchTable x_match;
+}
+
+inline bool lgs::CPUWorker::eval_cell_x(const bool* state_r, const bool* known_r, int x, int y, bool& known) const
+{
+        unsigned int cell = circuit_data[y*width + x];
+        int x0 = x + 1 + ((cell>>16) % 2);
+        int y1 = y - 1 - ((cell>>17) % 2);
+        int x2 = x - 1 - ((cell>>18) % 2);
+        int y3 = y + 1 + ((cell>>19) % 2);
+        int v = 0, k = 15;
+        if(x0 < width) { v |= state_r[y*width + x0]; k ^= !known_r[y*width + x0]; }
+        if(y1 >= 0) { v |= state_r[y1*width + x] << 1; k ^= !known_r[y1*width + x] << 1; }
+        if(x2 >= 0) { v |= state_r[y*width + x2] << 2; k ^= !known_r[y*width + x2] << 2; }
+        if(y3 < height) { v |= state_r[y3*width + x] << 3; k ^= !known_r[y3*width + x] << 3; }
+        unsigned int m = x_match.m[k][v];
+        unsigned int t = cell & m;
+        known = t == 0 || t == m;
+        return t == m;
+}
+
+void lgs::CPUWorker::sim_step_x(const bool* state_r, const bool* known_r, bool* state_w, bool* known_w)
+{
+        if(cone_mask != NULL)
+        {
+                for(std::vector<int>::const_iterator i = cone_cells.begin(); i != cone_cells.end(); ++i)
+                        state_w[*i] = eval_cell_x(state_r, known_r, *i % width, *i / width, known_w[*i]);
+                return;
+        }
+        for(int y = 0; y < height; y++)
+                for(int x = 0; x < width; x++)
+                        state_w[y*width + x] = eval_cell_x(state_r, known_r, x, y, known_w[y*width + x]);
 }
 
 void lgs::CPUWorker::sim_step(const bool* state_r, bool* state_w)
 {
-       for(int y = 0; y < height; y++)
-               for(int x = 0; x < width; x++)
-               {
-                       int x0 = x + 1 + ((circuit_data[y*width+x]>>16) % 2);
-                       int y1 = y - 1 - ((circuit_data[y*width+x]>>17) % 2);
-                       int x2 = x - 1 - ((circuit_data[y*width+x]>>18) % 2);
-                       int y3 = y + 1 + ((circuit_data[y*width+x]>>19) % 2);
-                       bool a0 = x0 < width ? state_r[y*width + x0] : false;
-                       bool a1 = y1 >= 0 ? state_r[y1*width + x] : false;
-                       bool a2 = x2 >= 0 ? state_r[y*width + x2] : false;
-                       bool a3 = y3 < height ? state_r[y3*width + x] : false;
-                       int ws = a3 ? circuit_data[y*width + x] / 256 : circuit_data[y*width + x];
-                       ws = a2 ? ws / 16 : ws;
-                       ws = a1 ? ws / 4 : ws;
-                       ws = a0 ? ws / 2 : ws;
-                       state_w[y*width + x] = ws % 2 == 1;
-             } 
-}
-
-void lgs::CPUWorker::tickSimulation()
-{
-#ifdef LGS_PROFILE
-        std::chrono::steady_clock::time_point t0, t1;
-        t0 = std::chrono::steady_clock::now();
-#endif 
-        this->sim_step(state_r, state_w);
-#ifdef LGS_PROFILE 
-        t1 = std::chrono::steady_clock::now();
-        profile_time_logic += t1 - t0;
-#endif
-        for(std::vector<Peripheral*>::const_iterator peri = peripherals.begin(); peri != peripherals.end(); ++peri)
-                (*peri)->tick(state_r, state_w, width, height); 
-#ifdef LGS_PROFILE
-        t0 = std::chrono::steady_clock::now();
-        profile_time_peripherals += t0 - t1;
-        ++profile_n_ticks;
-        if(profile_n_ticks >= LGS_PROFILE_N_SAMPLES)
-        {
-                profile_time_logic /= profile_n_ticks;
-                profile_time_peripherals /= profile_n_ticks;
-                std::stringstream str;
-                str << "CPU Worker Profiling.\n";
-                str << "Average tick time over " << profile_n_ticks << " ticks for logic tick is ";
-                str << std::chrono::duration_cast<std::chrono::microseconds>(profile_time_logic).count();
-                str << " microseconds and for peripheral tick is ";
-                str << std::chrono::duration_cast<std::chrono::microseconds>(profile_time_peripherals).count();
-                str << "microseconds.\n";
-                prof_sec->setText(str.str());
-                profile_n_ticks = 0;
-                profile_time_logic = std::chrono::steady_clock::duration(0);
-                profile_time_peripherals = std::chrono::steady_clock::duration(0);
-        }
-#endif
+        if(cone_mask != NULL)
+        {
+                for(std::vector<int>::const_iterator i = cone_cells.begin(); i != cone_cells.end(); ++i)
+                        state_w[*i] = eval_cell(state_r, *i % width, *i / width);
+                return;
+        }
+        for(int y = 0; y < height; y++)
+                for(int x = 0; x < width; x++)
+                        state_w[y*width + x] = eval_cell(state_r, x, y);
+}
+
+void lgs::CPUWorker::sim_step_regions(const bool* state_r, bool* state_w)
+{
+        // Bring the write buffer up to date for the bits that changed in the last tick, as activity elements may not rewrite them.
+        for(std::vector<int>::const_iterator i = changed_cells.begin(); i != changed_cells.end(); ++i)
+                state_w[*i] = state_r[*i];
+
+        for(std::vector<std::pair<int, int>>::const_iterator span = dense_spans.begin(); span != dense_spans.end(); ++span)
+        {
+                int y = span->first / width;
+                for(int x = span->first % width, e = x + span->second - span->first; x < e; x++)
+                        state_w[y*width + x] = eval_cell(state_r, x, y);
+        }
+
+        dirty_cells.clear();
+        if(!activity_primed)
+        {
+                for(int i = 0; i < width*height; i++)
+                        if(cell_kernel[i] == KERNEL_ACTIVITY)
+                        {
+                                dirty[i] = true;
+                                dirty_cells.push_back(i);
+                        }
+                activity_primed = true;
+        }
+        else
+        {
+                for(std::vector<int>::const_iterator i = changed_cells.begin(); i != changed_cells.end(); ++i)
+                        mark_readers_dirty(*i);
+                for(std::vector<int>::const_iterator i = driven_active_cells.begin(); i != driven_active_cells.end(); ++i)
+                        if(!dirty[*i])
+                        {
+                                dirty[*i] = true;
+                                dirty_cells.push_back(*i);
+                        }
+        }
+        for(std::vector<int>::const_iterator i = dirty_cells.begin(); i != dirty_cells.end(); ++i)
+        {
+                state_w[*i] = eval_cell(state_r, *i % width, *i / width);
+                dirty[*i] = false;
+        }
+}
+
+void lgs::CPUWorker::mark_readers_dirty(int p)
+{
+        // Element at distance d in direction i reads p iff the skip bit of its input on that side matches.
+        static const int dx[4] = {-1, 0, 1, 0};
+        static const int dy[4] = {0, 1, 0, -1};
+        int px = p % width, py = p / width;
+        for(int i = 0; i < 4; i++)
+                for(int d = 1; d <= 2; d++)
+                {
+                        int x = px + d*dx[i], y = py + d*dy[i];
+                        if(x < 0 || x >= width || y < 0 || y >= height) continue;
+                        int r = y*width + x;
+                        if(cell_kernel[r] == KERNEL_ACTIVITY && (int) ((circuit_data[r]>>(16+i)) % 2) == d-1 && !dirty[r])
+                        {
+                                dirty[r] = true;
+                                dirty_cells.push_back(r);
+                        }
+                }
+}
+
+void lgs::CPUWorker::collect_changes(const bool* state_r, const bool* state_w)
+{
+        changed_cells.clear();
+        for(std::vector<int>::const_iterator i = dirty_cells.begin(); i != dirty_cells.end(); ++i)
+                if(state_w[*i] != state_r[*i]) changed_cells.push_back(*i);
+        for(std::vector<int>::const_iterator i = halo_cells.begin(); i != halo_cells.end(); ++i)
+                if(state_w[*i] != state_r[*i]) changed_cells.push_back(*i);
+        for(std::vector<int>::const_iterator i = driven_cells.begin(); i != driven_cells.end(); ++i)
+                if(state_w[*i] != state_r[*i]) changed_cells.push_back(*i);
+}
+
+int lgs::CPUWorker::assignRegions(const std::vector<Region>& overrides, int tileSize)
+{
+        delete[] cell_kernel;
+        delete[] dirty;
+        cell_kernel = new unsigned char[width*height];
+        dirty = new bool[width*height];
+
+        // Trial run on scratch buffers, counting the changes in each tile.
+        const int tile = tileSize;
+        int tiles_x = (width + tile - 1) / tile, tiles_y = (height + tile - 1) / tile;
+        std::vector<long int> tile_changes(tiles_x * tiles_y, 0);
+        bool* trial_r = new bool[width*height];
+        bool* trial_w = new bool[width*height];
+        for(int i = 0; i < width*height; i++)
+                trial_r[i] = state_r[i];
+        for(int t = 0; t < LGS_REGION_SAMPLE_TICKS; t++)
+        {
+                for(int y = 0; y < height; y++)
+                        for(int x = 0; x < width; x++)
+                        {
+                                trial_w[y*width + x] = eval_cell(trial_r, x, y);
+                                if(trial_w[y*width + x] != trial_r[y*width + x]) ++tile_changes[(y/tile)*tiles_x + x/tile];
+                        }
+                bool* tmp = trial_r;
+                trial_r = trial_w;
+                trial_w = tmp;
+        }
+        delete[] trial_r;
+        delete[] trial_w;
+
+        // A dense tile costs one evaluation per element, an activity tile LGS_REGION_ACTIVITY_COST per change.
+        for(int y = 0; y < height; y++)
+                for(int x = 0; x < width; x++)
+                {
+                        int ti = (y/tile)*tiles_x + x/tile;
+                        int tw = std::min(tile, width - (x/tile)*tile), th = std::min(tile, height - (y/tile)*tile);
+                        bool active = tile_changes[ti] * LGS_REGION_ACTIVITY_COST < (long int) tw * th * LGS_REGION_SAMPLE_TICKS;
+                        cell_kernel[y*width + x] = active ? KERNEL_ACTIVITY : KERNEL_DENSE;
+                        dirty[y*width + x] = false;
+                }
+        for(std::vector<Region>::const_iterator r = overrides.begin(); r != overrides.end(); ++r)
+                for(int y = std::max(r->y, 0); y < std::min(r->y + r->h, height); y++)
+                        for(int x = std::max(r->x, 0); x < std::min(r->x + r->w, width); x++)
+                                cell_kernel[y*width + x] = r->kernel;
+
+        dense_spans.clear();
+        for(int y = 0; y < height; y++)
+                for(int x = 0; x < width; x++)
+                        if(cell_kernel[y*width + x] == KERNEL_DENSE)
+                        {
+                                if(x > 0 && cell_kernel[y*width + x - 1] == KERNEL_DENSE) ++dense_spans.back().second;
+                                else dense_spans.push_back(std::pair<int, int>(y*width + x, y*width + x + 1));
+                        }
+
+        int n_active = 0;
+        halo_cells.clear();
+        for(int i = 0; i < width*height; i++)
+        {
+                if(cell_kernel[i] == KERNEL_ACTIVITY)
+                {
+                        ++n_active;
+                        for(int k = 0; k < 4; k++)
+                        {
+                                int j = input_index(i % width, i / width, k);
+                                if(j >= 0 && cell_kernel[j] == KERNEL_DENSE && !dirty[j])
+                                {
+                                        dirty[j] = true;
+                                        halo_cells.push_back(j);
+                                }
+                        }
+                }
+        }
+        for(std::vector<int>::const_iterator i = halo_cells.begin(); i != halo_cells.end(); ++i)
+                dirty[*i] = false;
+        driven_active_cells.clear();
+        for(std::vector<int>::const_iterator i = driven_cells.begin(); i != driven_cells.end(); ++i)
+                if(cell_kernel[*i] == KERNEL_ACTIVITY) driven_active_cells.push_back(*i);
+
+        changed_cells.clear();
+        dirty_cells.clear();
+        activity_primed = false;
+        n_active_cells = n_active;
+        return n_active;
+}
+
+int lgs::CPUWorker::restrictToCone(const std::vector<std::pair<int, int>>& observed)
+{
+        // Bits of the truth table for which input ai is 0. The table depends on ai iff flipping ai changes some output.
+        static const unsigned int low_half[4] = {0x5555, 0x3333, 0x0F0F, 0x00FF};
+
+        delete[] cone_mask;
+        cone_mask = new bool[width*height];
+        for(int i = 0; i < width*height; i++)
+                cone_mask[i] = false;
+
+        std::vector<int> stack;
+        for(std::vector<std::pair<int, int>>::const_iterator p = observed.begin(); p != observed.end(); ++p)
+                if(0 <= p->first && p->first < width && 0 <= p->second && p->second < height && !cone_mask[p->second*width + p->first])
+                {
+                        cone_mask[p->second*width + p->first] = true;
+                        stack.push_back(p->second*width + p->first);
+                }
+        while(!stack.empty())
+        {
+                int c = stack.back();
+                stack.pop_back();
+                unsigned int table = circuit_data[c] & 0xFFFF;
+                for(int i = 0; i < 4; i++)
+                {
+                        if((table & low_half[i]) == ((table >> (1<<i)) & low_half[i]))
+                                continue;
+                        int k = input_index(c % width, c / width, i);
+                        if(k >= 0 && !cone_mask[k])
+                        {
+                                cone_mask[k] = true;
+                                stack.push_back(k);
+                        }
+                }
+        }
+
+        cone_cells.clear();
+        for(int i = 0; i < width*height; i++)
+        {
+                if(cone_mask[i]) cone_cells.push_back(i);
+                state_r[i] = false;
+                state_w[i] = false;
+        }
+        n_cone_cells = (int) cone_cells.size();
+        return n_cone_cells;
+}
+
+void lgs::CPUWorker::evaluate()
+{
+        if(known_r != NULL) this->sim_step_x(state_r, known_r, state_w, known_w);
+        else if(cell_kernel != NULL) this->sim_step_regions(state_r, state_w);
+        else this->sim_step(state_r, state_w);
+}
+
+bool* lgs::CPUWorker::getNextState()
+{
+        return state_w;
+}
+
+void lgs::CPUWorker::commit()
+{
+        if(cell_kernel != NULL) collect_changes(state_r, state_w);
         bool* tmp = state_r;
         state_r = state_w;
         state_w = tmp;
+        ++n_ticks;
+
+        if(known_r != NULL)
+        {
+                for(std::vector<int>::const_iterator i = driven_cells.begin(); i != driven_cells.end(); ++i)
+                        known_w[*i] = true;
+                tmp = known_r;
+                known_r = known_w;
+                known_w = tmp;
+                if(settle_tick < 0)
+                {
+                        std::vector<int>::const_iterator i = x_observed.begin();
+                        while(i != x_observed.end() && known_r[*i]) ++i;
+                        if(i == x_observed.end()) settle_tick = n_ticks;
+                }
+        }
+}
+
+bool lgs::CPUWorker::isStable()
+{
+        // Outside region mode the write buffer holds the whole state before the last tick
+        if(cell_kernel != NULL) return false;
+        if(std::memcmp(state_r, state_w, width*height*sizeof(bool)) != 0) return false;
+        return known_r == NULL || std::memcmp(known_r, known_w, width*height*sizeof(bool)) == 0;
 }
 
 const bool* lgs::CPUWorker::getState()
 {
         return state_r;
 }
+
+const bool* lgs::CPUWorker::getMask()
+{
+        return cone_mask;
+}
+
+std::string lgs::CPUWorker::getReport()
+{
+        std::stringstream str;
+        if(n_cone_cells >= 0)
+                str << "Simulated cone of influence of " << n_cone_cells << " out of " << width*height << " logic elements\n";
+        if(n_active_cells >= 0)
+                str << "Simulated " << n_active_cells << " out of " << width*height << " logic elements with the activity kernel\n";
+        if(known_r != NULL)
+        {
+                if(settle_tick < 0) str << "Observed bits are still X after the simulation\n";
+                else str << "All observed bits became known (non-X) at tick " << settle_tick << "\n";
+        }
+        return str.str();
+}
+
+void lgs::CPUWorker::enableXPropagation(const std::vector<std::pair<int, int>>& observed)
+{
+        delete[] known_r;
+        delete[] known_w;
+        known_r = new bool[width*height];
+        known_w = new bool[width*height];
+        for(int i = 0; i < width*height; i++)
+        {
+                known_r[i] = false;
+                known_w[i] = false;
+                state_r[i] = false;
+                state_w[i] = false;
+        }
+
+        x_observed.clear();
+        for(std::vector<std::pair<int, int>>::const_iterator p = observed.begin(); p != observed.end(); ++p)
+                if(0 <= p->first && p->first < width && 0 <= p->second && p->second < height)
+                        x_observed.push_back(p->second*width + p->first);
+        settle_tick = -1;
+}
+
+const bool* lgs::CPUWorker::getKnown()
+{
+        return known_r;
+}
+
+long int lgs::CPUWorker::getSettleTick()
+{
+        return settle_tick;
+}
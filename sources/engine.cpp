@@ -0,0 +1,90 @@
+/*
+ * Implementation for engine.hpp
+ */
+
+#include <string>
+#include <vector>
+
+#include <ncursesio.hpp>
+#include <lane.hpp>
+#include <cpuworker.hpp>
+
+#include <engine.hpp>
+
+void lgs::Engine::step(int n)
+{
+        for(int i = 0; i < n; i++)
+        {
+                evaluate();
+                commit();
+        }
+}
+
+void lgs::Engine::gatherLanes(const LaneSet& lanes, LaneWord* words)
+{
+        const bool* state = getState();
+        const int* cells = lanes.cells.data();
+        for(int l = 0; l < lanes.size(); l++)
+        {
+                LaneWord word = 0;
+                for(int i = lanes.begins[l+1] - 1; i >= lanes.begins[l]; --i)
+                        word = (word << 1) | (cells[i] >= 0 && state[cells[i]] ? 1 : 0);
+                words[l] = word;
+        }
+}
+
+void lgs::Engine::scatterLanes(const LaneSet& lanes, const LaneWord* words, const bool* drive)
+{
+        bool* state = getNextState();
+        const int* cells = lanes.cells.data();
+        for(int l = 0; l < lanes.size(); l++)
+        {
+                if(!drive[l]) continue;
+                LaneWord word = words[l];
+                for(int i = lanes.begins[l]; i < lanes.begins[l+1]; i++, word >>= 1)
+                        if(cells[i] >= 0) state[cells[i]] = (word & 1) != 0;
+        }
+}
+
+const bool* lgs::Engine::getKnown() { return NULL; }
+
+const bool* lgs::Engine::getMask() { return NULL; }
+
+std::string lgs::Engine::getReport() { return std::string(""); }
+
+bool lgs::Engine::isStable() { return false; }
+
+std::vector<std::string> lgs::engineNames()
+{
+        std::vector<std::string> names;
+        names.push_back("dense");
+        names.push_back("regions");
+        names.push_back("xprop");
+        return names;
+}
+
+lgs::Engine* lgs::engineFromName(const std::string& name, const unsigned int* crd, int w, int h, const EngineOptions& options)
+{
+        if(name != std::string("dense") && name != std::string("regions") && name != std::string("xprop"))
+        {
+                lgs::print("Unknown engine: ");
+                lgs::print(name);
+                lgs::print("\n");
+                lgs::exitNcursesMode(true);
+                return NULL;
+        }
+
+        CPUWorker* worker = new CPUWorker(options.driven);
+        worker->loadCircuit(crd, w, h);
+        if(options.state != NULL)
+                worker->loadState(options.state);
+        if(options.cone && name == std::string("regions"))
+                lgs::print("WARNING: The regions engine does not support cone of influence simulation, simulating the whole board.\n");
+        else if(options.cone)
+                worker->restrictToCone(options.observed);
+        if(name == std::string("xprop"))
+                worker->enableXPropagation(options.observed);
+        else if(name == std::string("regions"))
+                worker->assignRegions(options.regions, options.tile_size);
+        return worker;
+}
@@ -0,0 +1,100 @@
+/*
+ * Implementation for filestream.hpp
+ */
+
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cerrno>
+
+#include <ncursesio.hpp>
+#include <logicsim.hpp>
+
+#include <filestream.hpp>
+
+lgs::FileStream::FileStream(const std::string& path, bool write) : buffer(LGS_FILE_BUFFER_SIZE), path(path), writing(write), 
+        closing(false), file_ended(false), failed(false)
+{
+        file = std::fopen(path.c_str(), write ? "wb" : "rb");
+        if(file == NULL)
+        {
+                lgs::print("Failed to open file " + path + "\n");
+                lgs::exitNcursesMode(true);
+        }
+        worker = std::thread(&lgs::FileStream::run, this);
+}
+
+lgs::FileStream::~FileStream()
+{
+        close();
+}
+
+void lgs::FileStream::run()
+{
+        unsigned char* chunk = new unsigned char[LGS_FILE_CHUNK_SIZE];
+        while(true)
+        {
+                if(writing)
+                {
+                        std::size_t n = buffer.popSome(chunk, LGS_FILE_CHUNK_SIZE);
+                        // Keep taking bytes after a failure, so the simulation is never held up by a file that cannot be written
+                        if(n > 0 && std::fwrite(chunk, 1, n, file) != n) failed.store(true, std::memory_order_release);
+                        else if(closing.load()) break;
+                        else std::this_thread::sleep_for(std::chrono::milliseconds(LGS_FILE_IDLE_TIME));
+                }
+                else
+                {
+                        if(closing.load()) break;
+                        if(buffer.capacity() - buffer.size() < LGS_FILE_CHUNK_SIZE)
+                        {
+                                std::this_thread::sleep_for(std::chrono::milliseconds(LGS_FILE_IDLE_TIME));
+                                continue;
+                        }
+                        // Pipes, FIFOs and terminals can give short reads before the end, so only stop at end of file or on an error
+                        std::size_t n = std::fread(chunk, 1, LGS_FILE_CHUNK_SIZE, file);
+                        buffer.pushSome(chunk, n);
+                        if(n == LGS_FILE_CHUNK_SIZE) continue;
+                        if(std::ferror(file) && errno == EINTR) std::clearerr(file);
+                        else if(std::feof(file) || std::ferror(file))
+                        {
+                                if(std::ferror(file)) failed.store(true, std::memory_order_release);
+                                file_ended.store(true, std::memory_order_release);
+                                break;
+                        }
+                }
+        }
+        delete[] chunk;
+}
+
+bool lgs::FileStream::read(unsigned char& byte) { return buffer.pop(byte); }
+
+bool lgs::FileStream::atEnd() const { return file_ended.load(std::memory_order_acquire) && buffer.size() == 0; }
+
+bool lgs::FileStream::write(unsigned char byte) { return buffer.push(byte); }
+
+bool lgs::FileStream::canWrite() const { return buffer.size() < buffer.capacity(); }
+
+void lgs::FileStream::writeAll(const unsigned char* bytes, std::size_t n)
+{
+        while(n > 0)
+        {
+                std::size_t pushed = buffer.pushSome(bytes, n);
+                bytes += pushed;
+                n -= pushed;
+                if(n > 0) std::this_thread::yield();
+        }
+}
+
+void lgs::FileStream::close()
+{
+        if(!worker.joinable()) return;
+        closing.store(true);
+        worker.join();
+        if(std::fclose(file) != 0) failed.store(true, std::memory_order_release);
+}
+
+bool lgs::FileStream::hasFailed() const { return failed.load(std::memory_order_acquire); }
+
+const std::string& lgs::FileStream::getPath() const { return path; }
@@ -0,0 +1,487 @@
+/*
+ * Implementation for gifpipeline.hpp
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include <ncursesio.hpp>
+#include <logicsim.hpp>
+
+#include <gifpipeline.hpp>
+
+namespace
+{
+        /*
+         * The palette has 2^palette_bits colors. Index 0 is transparent, for bits that did not change, and 1 to 4 are the 0, 1, X
+         * and masked colors.
+         */
+        const int palette_bits = 3;
+        const uint8_t palette[1 << palette_bits][3] = {
+                { 0, 0, 0 },
+                { LGS_GIF_COLOR_0_R, LGS_GIF_COLOR_0_G, LGS_GIF_COLOR_0_B },
+                { LGS_GIF_COLOR_1_R, LGS_GIF_COLOR_1_G, LGS_GIF_COLOR_1_B },
+                { LGS_GIF_COLOR_X_R, LGS_GIF_COLOR_X_G, LGS_GIF_COLOR_X_B },
+                { LGS_GIF_COLOR_MASK_R, LGS_GIF_COLOR_MASK_G, LGS_GIF_COLOR_MASK_B },
+                { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+        const int max_delay = 0xffff;                                   // Largest delay a gif frame can hold.
+
+        void put_word(FILE* f, int v)
+        {
+                fputc(v & 0xff, f);
+                fputc((v >> 8) & 0xff, f);
+        }
+
+        /*
+         * Packs variable length LZW codes into bytes, least significant bit first, and writes them out in sub-blocks of 255 bytes.
+         */
+        struct CodeWriter
+        {
+                FILE* f;
+                uint32_t bits;
+                int n_bits;
+                uint8_t block[255];
+                int n_block;
+
+                CodeWriter(FILE* file) : f(file), bits(0), n_bits(0), n_block(0) {}
+                void put(uint32_t code, int size)
+                {
+                        bits |= code << n_bits;
+                        n_bits += size;
+                        while(n_bits >= 8)
+                        {
+                                block[n_block++] = bits & 0xff;
+                                bits >>= 8;
+                                n_bits -= 8;
+                                if(n_block == 255) flush_block();
+                        }
+                }
+                void flush_block()
+                {
+                        fputc(n_block, f);
+                        fwrite(block, 1, n_block, f);
+                        n_block = 0;
+                }
+                void finish()
+                {
+                        if(n_bits > 0) put(0, 8 - n_bits);
+                        if(n_block > 0) flush_block();
+                        fputc(0, f);                                    // Block terminator.
+                }
+        };
+
+        /*
+         * LZW compresses a stream of palette indices, fed to it a scanline at a time. The dictionary is a tree of codes with one
+         * child per palette index.
+         */
+        struct LzwCoder
+        {
+                static const uint32_t clear_code = 1 << palette_bits;
+                CodeWriter out;
+                std::vector<uint16_t> tree;
+                int code_size;
+                uint32_t max_code;
+                int32_t code;
+
+                LzwCoder(FILE* f)
+                        : out(f), tree(4096 << palette_bits, 0), code_size(palette_bits + 1), max_code(clear_code + 1), code(-1)
+                {
+                        fputc(palette_bits, f);
+                        out.put(clear_code, code_size);
+                }
+                void put(const uint8_t* line, int n)
+                {
+                        for(int i = 0; i < n; i++)
+                        {
+                                uint8_t index = line[i];
+                                if(code < 0)
+                                        code = index;
+                                else if(tree[(code << palette_bits) + index] != 0)
+                                        code = tree[(code << palette_bits) + index];
+                                else
+                                {
+                                        out.put(code, code_size);
+                                        tree[(code << palette_bits) + index] = (uint16_t) ++max_code;
+                                        if(max_code >= (1u << code_size)) code_size++;
+                                        if(max_code == 4095)
+                                        {
+                                                out.put(clear_code, code_size);
+                                                std::fill(tree.begin(), tree.end(), 0);
+                                                code_size = palette_bits + 1;
+                                                max_code = clear_code + 1;
+                                        }
+                                        code = index;
+                                }
+                        }
+                }
+                void finish()
+                {
+                        out.put(code, code_size);
+                        out.put(clear_code, code_size);
+                        out.put(clear_code + 1, palette_bits + 1);
+                        out.finish();
+                }
+        };
+}
+
+lgs::GifPipeline::GifPipeline(const std::string& path, int boardWidth, const OutputView& outputView, int frameTime)
+        : board_width(boardWidth), view(outputView), width((view.w + view.shrink - 1) / view.shrink),
+          height((view.h + view.shrink - 1) / view.shrink), scale(view.scale), frame_time(frameTime), n_words((width*height + 63) / 64),
+          has_last(false), n_captured(0), n_diffed(0), diffed_all(false), n_jobs(0), n_written(0), finishing(false), max_depth(0),
+          n_stalls(0), stall_time(0)
+{
+        file = fopen(path.c_str(), "wb");
+        if(file == NULL)
+        {
+                lgs::print("Failed to open output gif " + path + "\n");
+                lgs::exitNcursesMode(true);
+        }
+        // Header, with the palette as the global color table, and the looping extension
+        fputs("GIF89a", file);
+        put_word(file, width * scale);
+        put_word(file, height * scale);
+        fputc(0xf0 | (palette_bits - 1), file);
+        fputc(0, file);
+        fputc(0, file);
+        fwrite(palette, 1, sizeof(palette), file);
+        if(frame_time != 0)
+        {
+                fputc(0x21, file);
+                fputc(0xff, file);
+                fputc(11, file);
+                fputs("NETSCAPE2.0", file);
+                fputc(3, file);
+                fputc(1, file);
+                put_word(file, 0);                                      // Loop forever.
+                fputc(0, file);
+        }
+
+        last_state = view.shrink > 1 && view.pooling == POOLING_ACTIVITY ? new bool[view.w * view.h] : NULL;
+        slots = new Slot[LGS_GIF_RING_SIZE];
+        for(int i = 0; i < LGS_GIF_RING_SIZE; i++)
+        {
+                slots[i].bits = new uint64_t[3 * n_words];
+                slots[i].full = false;
+        }
+        // One encoder per core left over by the simulation and the differ, and a buffer for each plus the two the differ holds
+        int n_encoders = (int) std::thread::hardware_concurrency() - 2;
+        if(n_encoders > LGS_GIF_ENCODERS) n_encoders = LGS_GIF_ENCODERS;
+        if(n_encoders < 1) n_encoders = 1;
+        for(int i = 0; i < n_encoders + 2; i++)
+        {
+                Job job;
+                job.image = new uint8_t[width * height];
+                free_jobs.push_back(job);
+        }
+        differ = std::thread(&lgs::GifPipeline::run_differ, this);
+        for(int i = 0; i < n_encoders; i++)
+                encoders.push_back(std::thread(&lgs::GifPipeline::run_encoder, this));
+}
+
+lgs::GifPipeline::~GifPipeline()
+{
+        finish();
+        for(int i = 0; i < LGS_GIF_RING_SIZE; i++)
+                delete[] slots[i].bits;
+        delete[] slots;
+        delete[] last_state;
+        for(std::vector<Job>::iterator j = free_jobs.begin(); j != free_jobs.end(); ++j)
+                delete[] j->image;
+}
+
+void lgs::GifPipeline::capture(const bool* state, const bool* known, const bool* mask)
+{
+        Slot& slot = slots[n_captured % LGS_GIF_RING_SIZE];
+        {
+                std::unique_lock<std::mutex> guard(lock);
+                if(slot.full)
+                {
+                        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                        ++n_stalls;
+                        while(slot.full) slot_freed.wait(guard);
+                        stall_time += std::chrono::steady_clock::now() - t0;
+                }
+        }
+
+        // Pack the planes, outside the lock as the differ does not read a free slot
+        pack(slot, state, known, mask);
+        slot.full = true;
+
+        std::lock_guard<std::mutex> guard(lock);
+        ++n_captured;
+        if(n_captured - n_diffed > max_depth) max_depth = (int) (n_captured - n_diffed);
+        frame_captured.notify_one();
+}
+
+void lgs::GifPipeline::pack(Slot& slot, const bool* state, const bool* known, const bool* mask)
+{
+        uint64_t* words[3] = { slot.bits, slot.bits + n_words, slot.bits + 2 * n_words };
+        for(int i = 0; i < 3 * n_words; i++)
+                slot.bits[i] = 0;
+        slot.has_known = known != NULL;
+        slot.has_mask = mask != NULL;
+        if(view.shrink == 1)
+        {
+                for(int y = 0; y < height; y++)
+                        for(int x = 0; x < width; x++)
+                        {
+                                int i = (view.y + y) * board_width + view.x + x, c = y*width + x;
+                                uint64_t bit = (uint64_t) 1 << (c % 64);
+                                if(state[i]) words[0][c / 64] |= bit;
+                                if(known != NULL && known[i]) words[1][c / 64] |= bit;
+                                if(mask != NULL && mask[i]) words[2][c / 64] |= bit;
+                        }
+                return;
+        }
+
+        for(int py = 0; py < height; py++)
+                for(int px = 0; px < width; px++)
+                {
+                        int n_simulated = 0, n_known = 0, n_ones = 0;
+                        bool changed = false;
+                        for(int y = py * view.shrink; y < std::min((py + 1) * view.shrink, view.h); y++)
+                                for(int x = px * view.shrink; x < std::min((px + 1) * view.shrink, view.w); x++)
+                                {
+                                        int i = (view.y + y) * board_width + view.x + x;
+                                        if(last_state != NULL)
+                                        {
+                                                changed |= has_last && last_state[y * view.w + x] != state[i];
+                                                last_state[y * view.w + x] = state[i];
+                                        }
+                                        if(mask != NULL && !mask[i]) continue;
+                                        n_simulated++;
+                                        if(known != NULL && !known[i]) continue;
+                                        n_known++;
+                                        n_ones += state[i];
+                                }
+                        bool one = view.pooling == POOLING_OR ? n_ones > 0 : view.pooling == POOLING_MAJORITY ? 2 * n_ones > n_known : changed;
+                        int c = py*width + px;
+                        uint64_t bit = (uint64_t) 1 << (c % 64);
+                        if(one) words[0][c / 64] |= bit;
+                        if(n_known == n_simulated) words[1][c / 64] |= bit;
+                        if(n_simulated > 0) words[2][c / 64] |= bit;
+                }
+        has_last = true;
+}
+
+void lgs::GifPipeline::to_indices(const Slot& slot, uint8_t* indices) const
+{
+        const uint64_t* state = slot.bits;
+        const uint64_t* known = slot.has_known ? slot.bits + n_words : NULL;
+        const uint64_t* mask = slot.has_mask ? slot.bits + 2 * n_words : NULL;
+        for(int c = 0; c < width*height; c++)
+        {
+                uint64_t bit = (uint64_t) 1 << (c % 64);
+                uint8_t index = (state[c / 64] & bit) ? 2 : 1;
+                if(known != NULL && !(known[c / 64] & bit)) index = 3;
+                if(mask != NULL && !(mask[c / 64] & bit)) index = 4;
+                indices[c] = index;
+        }
+}
+
+lgs::GifPipeline::Job lgs::GifPipeline::take_job()
+{
+        std::unique_lock<std::mutex> guard(lock);
+        while(free_jobs.empty()) job_freed.wait(guard);
+        Job job = free_jobs.back();
+        free_jobs.pop_back();
+        return job;
+}
+
+void lgs::GifPipeline::queue_job(const Job& job)
+{
+        std::lock_guard<std::mutex> guard(lock);
+        jobs.push_back(job);
+        jobs.back().frame = n_jobs++;
+        job_ready.notify_one();
+}
+
+void lgs::GifPipeline::run_differ()
+{
+        uint8_t* current = new uint8_t[width * height];
+        uint8_t* previous = new uint8_t[width * height];
+        Job pending;                                                    // Held back until its delay is known.
+        bool has_pending = false;
+        for(long int k = 0; ; k++)
+        {
+                {
+                        std::unique_lock<std::mutex> guard(lock);
+                        while(n_diffed == n_captured && !finishing) frame_captured.wait(guard);
+                        if(n_diffed == n_captured) break;
+                }
+                Slot& slot = slots[k % LGS_GIF_RING_SIZE];
+                to_indices(slot, current);
+                {
+                        std::lock_guard<std::mutex> guard(lock);
+                        slot.full = false;
+                        ++n_diffed;
+                        slot_freed.notify_one();
+                }
+
+                // Bounding box of the changed bits, all of them in the first frame
+                int x0 = 0, y0 = 0, x1 = width - 1, y1 = height - 1;
+                if(k > 0)
+                {
+                        x0 = width; y0 = height; x1 = -1; y1 = -1;
+                        for(int y = 0; y < height; y++)
+                        {
+                                const uint8_t* cr = current + y * width;
+                                const uint8_t* pr = previous + y * width;
+                                if(std::memcmp(cr, pr, width) == 0) continue;
+                                int l = 0, r = width - 1;
+                                while(cr[l] == pr[l]) l++;
+                                while(cr[r] == pr[r]) r--;
+                                x0 = std::min(x0, l);
+                                x1 = std::max(x1, r);
+                                if(y0 == height) y0 = y;
+                                y1 = y;
+                        }
+                }
+                if(x1 < 0 && has_pending && pending.delay + frame_time <= max_delay)
+                {
+                        pending.delay += frame_time;
+                        continue;
+                }
+
+                Job job = take_job();
+                job.delay = frame_time;
+                if(x1 < 0)
+                {
+                        // Unchanged, but the frame before can hold no more delay
+                        job.x = job.y = 0;
+                        job.w = job.h = 1;
+                        job.image[0] = 0;
+                }
+                else
+                {
+                        job.x = x0;
+                        job.y = y0;
+                        job.w = x1 - x0 + 1;
+                        job.h = y1 - y0 + 1;
+                        for(int y = 0; y < job.h; y++)
+                                for(int x = 0; x < job.w; x++)
+                                {
+                                        int c = (y0 + y) * width + x0 + x;
+                                        job.image[y * job.w + x] = (k > 0 && current[c] == previous[c]) ? 0 : current[c];
+                                }
+                }
+                if(has_pending) queue_job(pending);
+                pending = job;
+                has_pending = true;
+                std::swap(current, previous);
+        }
+        if(has_pending) queue_job(pending);
+        {
+                std::lock_guard<std::mutex> guard(lock);
+                diffed_all = true;
+                job_ready.notify_all();
+        }
+        delete[] current;
+        delete[] previous;
+}
+
+void lgs::GifPipeline::encode(FILE* f, const Job& job) const
+{
+        // Graphic control extension, keeping the frame before under the transparent bits
+        fputc(0x21, f);
+        fputc(0xf9, f);
+        fputc(0x04, f);
+        fputc(0x05, f);
+        put_word(f, job.delay);
+        fputc(0, f);                                                    // Transparent index.
+        fputc(0, f);
+
+        // Image descriptor, using the global color table
+        fputc(0x2c, f);
+        put_word(f, job.x * scale);
+        put_word(f, job.y * scale);
+        put_word(f, job.w * scale);
+        put_word(f, job.h * scale);
+        fputc(0, f);
+
+        // Scale each row of the frame into one scanline, and feed it to the coder once per scaled row
+        LzwCoder coder(f);
+        std::vector<uint8_t> line(job.w * scale);
+        for(int y = 0; y < job.h; y++)
+        {
+                const uint8_t* row = job.image + y * job.w;
+                if(scale == 1)
+                        std::memcpy(line.data(), row, job.w);
+                else
+                        for(int x = 0; x < job.w; x++)
+                                std::memset(line.data() + x * scale, row[x], scale);
+                for(int i = 0; i < scale; i++)
+                        coder.put(line.data(), job.w * scale);
+        }
+        coder.finish();
+}
+
+void lgs::GifPipeline::run_encoder()
+{
+        while(true)
+        {
+                Job job;
+                {
+                        std::unique_lock<std::mutex> guard(lock);
+                        while(jobs.empty() && !diffed_all) job_ready.wait(guard);
+                        if(jobs.empty()) break;
+                        job = jobs.front();
+                        jobs.pop_front();
+                }
+
+                char* buffer = NULL;
+                size_t size = 0;
+                FILE* memory = open_memstream(&buffer, &size);
+                encode(memory, job);
+                fclose(memory);
+
+                // Hand back the buffer, then append every encoded frame that is next in order
+                std::lock_guard<std::mutex> guard(lock);
+                free_jobs.push_back(job);
+                job_freed.notify_one();
+                encoded[job.frame] = std::pair<char*, size_t>(buffer, size);
+                std::map<long int, std::pair<char*, size_t>>::iterator next;
+                while((next = encoded.find(n_written)) != encoded.end())
+                {
+                        fwrite(next->second.first, 1, next->second.second, file);
+                        free(next->second.first);
+                        encoded.erase(next);
+                        ++n_written;
+                }
+        }
+}
+
+void lgs::GifPipeline::finish()
+{
+        {
+                std::lock_guard<std::mutex> guard(lock);
+                if(finishing) return;
+                finishing = true;
+                frame_captured.notify_all();
+        }
+        differ.join();
+        for(std::vector<std::thread>::iterator t = encoders.begin(); t != encoders.end(); ++t)
+                t->join();
+        fputc(0x3b, file);
+        fclose(file);
+}
+
+std::string lgs::GifPipeline::getReport()
+{
+        std::stringstream str;
+        str << "Wrote " << n_captured << " states as " << n_written << " gif frames with " << encoders.size()
+                << " encoders, at most " << max_depth << " states in flight. The simulation waited on the gif " << n_stalls
+                << " times for " << std::chrono::duration_cast<std::chrono::milliseconds>(stall_time).count() << " ms.\n";
+        return str.str();
+}
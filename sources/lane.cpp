@@ -0,0 +1,70 @@
+/*
+ * Implementation for lane.hpp
+ */
+
+#include <vector>
+#include <utility>
+#include <string>
+
+#include <json.hpp>
+
+#include <ncursesio.hpp>
+
+#include <lane.hpp>
+
+lgs::Lane::Lane() {}
+
+lgs::Lane::Lane(const std::vector<std::pair<int, int>>& positions) : bits(positions)
+{
+        if(bits.size() > LGS_LANE_MAX_BITS)
+        {
+                lgs::print("Lane of ");
+                lgs::print(std::to_string(bits.size()));
+                lgs::print(" bits is wider than the maximum of " + std::to_string(LGS_LANE_MAX_BITS) + "\n");
+                lgs::exitNcursesMode(true);
+        }
+}
+
+int lgs::Lane::size() const { return (int) bits.size(); }
+
+const std::vector<std::pair<int, int>>& lgs::Lane::getPositions() const { return bits; }
+
+lgs::Lane lgs::laneFromJson(const nlohmann::json& laneJson)
+{
+        std::vector<std::pair<int, int>> positions;
+        if(laneJson.is_array())
+        {
+                for(nlohmann::json::const_iterator bit = laneJson.begin(); bit != laneJson.end(); ++bit)
+                        positions.push_back(std::pair<int, int>((*bit)["X"].get<int>(), (*bit)["Y"].get<int>()));
+        }
+        else if(laneJson.find("Length") != laneJson.end())
+        {
+                int x = laneJson["X"].get<int>(), y = laneJson["Y"].get<int>();
+                int step_x = laneJson.find("Step X") != laneJson.end() ? laneJson["Step X"].get<int>() : 1;
+                int step_y = laneJson.find("Step Y") != laneJson.end() ? laneJson["Step Y"].get<int>() : 0;
+                for(int i = 0; i < laneJson["Length"].get<int>(); i++)
+                        positions.push_back(std::pair<int, int>(x + i*step_x, y + i*step_y));
+        }
+        else positions.push_back(std::pair<int, int>(laneJson["X"].get<int>(), laneJson["Y"].get<int>()));
+        return Lane(positions);
+}
+
+lgs::LaneSet::LaneSet() : begins(1, 0) {}
+
+void lgs::LaneSet::add(const Lane& lane, int w, int h)
+{
+        const std::vector<std::pair<int, int>>& positions = lane.getPositions();
+        for(std::vector<std::pair<int, int>>::const_iterator p = positions.begin(); p != positions.end(); ++p)
+                cells.push_back(0 <= p->first && p->first < w && 0 <= p->second && p->second < h ? p->second*w + p->first : -1);
+        begins.push_back((int) cells.size());
+}
+
+int lgs::LaneSet::size() const { return (int) begins.size() - 1; }
+
+std::vector<std::pair<int, int>> lgs::LaneSet::getPositions(int w) const
+{
+        std::vector<std::pair<int, int>> positions;
+        for(std::vector<int>::const_iterator i = cells.begin(); i != cells.end(); ++i)
+                if(*i >= 0) positions.push_back(std::pair<int, int>(*i % w, *i / w));
+        return positions;
+}
@@ -7,16 +7,25 @@
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
+#include <cmath>
 #include <cassert>
+#include <climits>
 #include <chrono>
 #include <sstream>
+#include <vector>
+#include <utility>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
-#include <gif.h>
 #include <json.hpp>
 
-#include <cpuworker.hpp>
+#include <lane.hpp>
+#include <engine.hpp>
+#include <simulation.hpp>
+#include <autotune.hpp>
+#include <timesource.hpp>
+#include <pacer.hpp>
+#include <gifpipeline.hpp>
 #include <peripherals.hpp>
 #include <ncursesio.hpp>
 
@@ -39,29 +48,57 @@ namespace lgs
                 std::cout << "\t-t or --frametime\tThe arguement to this option is the time in milliseconds between each frame in the gif outputted. Default is " 
                         << LGS_DEFAULT_FRAMETIME << std::endl;
                 std::cout << "\t-c or --output-scale\tThe arguement to this option is the number of times to scale pixel sizes in the output gif. "
-                        << "Very useful for small circuits. Default is " << LGS_DEFAULT_SCALE_FACTOR << std::endl;
+                        << "Very useful for small circuits. A fraction 1/<n>, or a decimal like 0.25, instead shrinks each <n> by <n> block of bits into "
+                        << "one pixel, pooled as set by --output-pooling. Must be a whole number or the reciprocal of one. Default is " 
+                        << LGS_DEFAULT_SCALE_FACTOR << std::endl;
+                std::cout << "\t-g or --output-region\tThe arguement to this option is a region <x>,<y>,<width>,<height> of the board to show in "
+                        << "the output gif. Only that region is captured and encoded. By default the whole board is shown." << std::endl;
+                std::cout << "\t-P or --output-pooling\tThe arguement to this option is how a shrunk output gif pools a block of bits into one "
+                        << "pixel: or shows 1 if any bit is 1, majority if most bits are, and activity if any bit changed since the last frame. "
+                        << "Activity needs a shrinking --output-scale. Default is or" << std::endl;
+                std::cout << "\t-e or --engine\tThe arguement to this option is the name of the engine that simulates the circuit, one of";
+                std::vector<std::string> names = lgs::engineNames();
+                for(std::vector<std::string>::const_iterator name = names.begin(); name != names.end(); ++name)
+                        std::cout << " " << *name;
+                std::cout << ". Default is " << LGS_DEFAULT_ENGINE << std::endl;
+                std::cout << "\t-d or --pipeline-depth\tThe arguement to this option is the number of ticks by which peripherals may lag behind "
+                        << "the logic. If positive, peripherals are ticked on a separate thread, pipelined with the logic, and their writes take "
+                        << "effect that many ticks later than otherwise. Default is " << LGS_DEFAULT_PIPELINE_DEPTH << std::endl;
+                std::cout << "\t-i or --cone-of-influence\tThis option takes no arguement. Only the logic elements that can influence the bits "
+                        << "read by peripherals or probes are simulated. The rest hold 0 and are masked in the output gif." << std::endl;
+                std::cout << "\t-p or --probe\tThe arguement to this option is a position <x>,<y> of a bit to observe in cone of influence mode. "
+                        << "Can be given multiple times." << std::endl;
+                std::cout << "\t-x or --x-propagation\tThis option takes no arguement. Same as --engine xprop. Simulates with three valued "
+                        << "0/1/X logic, starting with all bits unknown (X). X bits are shown in a third color in the output gif, and the tick at which all bits read by "
+                        << "peripherals or probes become known is reported." << std::endl;
+                std::cout << "\t-r or --regions\tThis option takes no arguement. Same as --engine regions. Partitions the board into regions "
+                        << "and simulates each with the kernel that suits it best, as estimated from a short trial run. Also turned on if the circuit json has a \"Regions\" "
+                        << "array overriding the kernel of some regions." << std::endl;
+                std::cout << "\t-a or --autotune\tThis option takes no arguement. Benchmarks the ways to simulate the circuit from its state "
+                        << "after the first " << LGS_AUTOTUNE_RUN_TICKS << " ticks and switches to the fastest. The choice is cached in ~/" 
+                        << LGS_AUTOTUNE_CACHE_FILE << " per circuit and CPU model, and used from the start on later runs." << std::endl;
+                std::cout << "\t-v or --virtual-time\tThe arguement to this option is the number of ticks in a virtual millisecond. Peripherals "
+                        << "then measure time in ticks instead of on the wall clock, so runs are reproducible and not held back by real time. "
+                        << "Periods given in ticks are always virtual. By default time is real." << std::endl;
+                std::cout << "\t-R or --tick-rate\tThe arguement to this option is the number of ticks per second to run at. Ticks are run in "
+                        << "batches, sleeping in between when ahead of schedule. Runs of ticks where the board is at a fixed point and no peripheral is due "
+                        << "are skipped in one step, paced or not, so a paced idle circuit sleeps until its next wake or key press. By default, or if 0, "
+                        << "the simulation runs as fast as possible." << std::endl;
+                std::cout << "\t-H or --headless\tThis option takes no arguement. Runs without a terminal, for batch jobs and benchmarks. The "
+                        << "simulation starts right away, messages go to stderr, LEDArray states are logged to stderr when they change, no keys "
+                        << "are ever pressed, and the exit code is 0 only if the run succeeded." << std::endl;
+                std::cout << "\t-L or --log-stride\tThe arguement to this option is the number of ticks between checks for LEDArray states to "
+                        << "log in headless mode. The final states are always logged. Default is " << LGS_DEFAULT_LOG_STEPS << std::endl;
+                std::cout << "\t-O or --char-output\tThe arguement to this option is the file CharStreamPrinter output is written to in headless "
+                        << "mode. By default it is written to stdout." << std::endl;
                 std::cout << "\t<circuit path>\tThis is the path to the json circuit file." << std::endl;
                 std::cerr << std::endl << "Bad command line arguements." << std::endl;
                 std::exit(EXIT_FAILURE);
         }
 
-        void stateToFrame(uint8_t*& frame, const bool* state, int w, int h, int s)
-        {
-               for(int y = 0; y < h; y++)
-                      for(int x = 0; x < w; x++)
-                              for(int i = 0; i < s; i++)
-                                      for(int j = 0; j < s; j++)
-                                      {
-                                              int k = (y*s + j)*w*s + x*s + i;
-                                              bool s = state[y*w + x];
-                                              frame[k*4] = s ? LGS_GIF_COLOR_1_R : LGS_GIF_COLOR_0_R;
-                                              frame[k*4+1] = s ? LGS_GIF_COLOR_1_G : LGS_GIF_COLOR_0_G;
-                                              frame[k*4+2] = s ? LGS_GIF_COLOR_1_B : LGS_GIF_COLOR_0_B;
-                                              frame[k*4+3] = s ? LGS_GIF_COLOR_1_A : LGS_GIF_COLOR_0_A;
-                                      }
-        }
-
-        void parseArgs(int argc, char** argv, int& simLength, int& printStep, int& frameTime, int& scaleFactor, char*& imagePath)
+        void parseArgs(int argc, char** argv, int& simLength, int& printStep, int& frameTime, OutputView& outputView, int& pipelineDepth, bool& coneOfInfluence,
+                        std::string& engineName, bool& autotune, std::vector<std::pair<int, int>>& probes, double& ticksPerMillisecond, 
+                        double& tickRate, bool& headless, int& logStep, char*& charOutput, char*& imagePath)
         {
                 if(argc < 2) printUsage();
                 imagePath = argv[argc-1];
@@ -74,9 +111,96 @@ namespace lgs
                         else if(argv[i] == std::string("-t") || argv[i] == std::string("--frametime")) 
                                 frameTime = std::atoi(argv[++i]);
                         else if(argv[i] == std::string("-c") || argv[i] == std::string("--output-scale"))
-                                scaleFactor = std::atoi(argv[++i]);
+                        {
+                                std::string scale(argv[++i]);
+                                std::size_t k = scale.find('/');
+                                double factor = k == std::string::npos ? std::atof(scale.c_str()) 
+                                        : std::atof(scale.substr(0, k).c_str()) / std::atof(scale.substr(k+1).c_str());
+                                if(!(factor > 0)) printUsage();
+                                // Only whole scales and shrinks are drawn, so anything else is an error rather than rounded
+                                double whole = std::floor((factor >= 1 ? factor : 1 / factor) + 0.5);
+                                if(std::fabs((factor >= 1 ? factor : 1 / factor) - whole) > 1e-6 * whole) printUsage();
+                                outputView.scale = factor >= 1 ? (int) whole : 1;
+                                outputView.shrink = factor >= 1 ? 1 : (int) whole;
+                        }
+                        else if(argv[i] == std::string("-g") || argv[i] == std::string("--output-region"))
+                        {
+                                std::stringstream region(argv[++i]);
+                                char c1, c2, c3;
+                                if(!(region >> outputView.x >> c1 >> outputView.y >> c2 >> outputView.w >> c3 >> outputView.h) || c1 != ',' || c2 != ',' 
+                                                || c3 != ',') 
+                                        printUsage();
+                        }
+                        else if(argv[i] == std::string("-P") || argv[i] == std::string("--output-pooling"))
+                        {
+                                std::string pooling(argv[++i]);
+                                if(pooling == std::string("or")) outputView.pooling = POOLING_OR;
+                                else if(pooling == std::string("majority")) outputView.pooling = POOLING_MAJORITY;
+                                else if(pooling == std::string("activity")) outputView.pooling = POOLING_ACTIVITY;
+                                else printUsage();
+                        }
+                        else if(argv[i] == std::string("-d") || argv[i] == std::string("--pipeline-depth"))
+                                pipelineDepth = std::atoi(argv[++i]);
+                        else if(argv[i] == std::string("-i") || argv[i] == std::string("--cone-of-influence"))
+                                coneOfInfluence = true;
+                        else if(argv[i] == std::string("-e") || argv[i] == std::string("--engine"))
+                                engineName = argv[++i];
+                        else if(argv[i] == std::string("-x") || argv[i] == std::string("--x-propagation"))
+                                engineName = "xprop";
+                        else if(argv[i] == std::string("-r") || argv[i] == std::string("--regions"))
+                                engineName = "regions";
+                        else if(argv[i] == std::string("-a") || argv[i] == std::string("--autotune"))
+                                autotune = true;
+                        else if(argv[i] == std::string("-R") || argv[i] == std::string("--tick-rate"))
+                        {
+                                tickRate = std::atof(argv[++i]);
+                                if(tickRate < 0) printUsage();
+                        }
+                        else if(argv[i] == std::string("-H") || argv[i] == std::string("--headless"))
+                                headless = true;
+                        else if(argv[i] == std::string("-L") || argv[i] == std::string("--log-stride"))
+                                logStep = std::atoi(argv[++i]);
+                        else if(argv[i] == std::string("-O") || argv[i] == std::string("--char-output"))
+                                charOutput = argv[++i];
+                        else if(argv[i] == std::string("-v") || argv[i] == std::string("--virtual-time"))
+                        {
+                                ticksPerMillisecond = std::atof(argv[++i]);
+                                if(ticksPerMillisecond <= 0) printUsage();
+                        }
+                        else if(argv[i] == std::string("-p") || argv[i] == std::string("--probe"))
+                        {
+                                std::string pos(argv[++i]);
+                                std::size_t k = pos.find(',');
+                                if(k == std::string::npos) printUsage();
+                                probes.push_back(std::pair<int, int>(std::atoi(pos.substr(0, k).c_str()), std::atoi(pos.substr(k+1).c_str())));
+                        }
                         else printUsage();
                 }
+                if(outputView.pooling == POOLING_ACTIVITY && outputView.shrink == 1) printUsage();
+        }
+
+        /*
+         * Reads a region of the "Regions" array of the circuit json. Each region is a JSON object with integer fields "X", "Y", 
+         * "Width" and "Height" locating the region, and a string field "Kernel" naming the kernel for it, "Dense" or "Activity".
+         */
+        Region regionFromJson(const nlohmann::json& regionJson)
+        {
+                Region region;
+                region.x = regionJson["X"].get<int>();
+                region.y = regionJson["Y"].get<int>();
+                region.w = regionJson["Width"].get<int>();
+                region.h = regionJson["Height"].get<int>();
+                std::string kernel = regionJson["Kernel"].get<std::string>();
+                if(kernel == std::string("Dense")) region.kernel = KERNEL_DENSE;
+                else if(kernel == std::string("Activity")) region.kernel = KERNEL_ACTIVITY;
+                else
+                {
+                        lgs::print("Unknown region kernel: ");
+                        lgs::print(kernel);
+                        lgs::print("\n");
+                        lgs::exitNcursesMode(true);
+                }
+                return region;
         }
 }
 
@@ -92,13 +216,26 @@ int main(int argc, char** argv)
         int sim_length = LGS_DEFAULT_TIME_LENGTH;
         int print_step = LGS_DEFAULT_PRINT_STEPS;
         int frametime = LGS_DEFAULT_FRAMETIME;
-        int scale_factor = LGS_DEFAULT_SCALE_FACTOR;
+        OutputView output_view = { 0, 0, -1, -1, LGS_DEFAULT_SCALE_FACTOR, 1, POOLING_OR };
+        int pipeline_depth = LGS_DEFAULT_PIPELINE_DEPTH;
+        bool cone_of_influence = false;
+        std::string engine_name;
+        bool autotune = false;
+        std::vector<std::pair<int, int>> probes;
+        double ticks_per_millisecond = 0;
+        double tick_rate = 0;
+        bool headless = false;
+        int log_step = LGS_DEFAULT_LOG_STEPS;
+        char* char_output = NULL;
         char* json_path;
-        parseArgs(argc, argv, sim_length, print_step, frametime, scale_factor, json_path);
+        parseArgs(argc, argv, sim_length, print_step, frametime, output_view, pipeline_depth, cone_of_influence, engine_name, autotune, probes,
+                        ticks_per_millisecond, tick_rate, headless, log_step, char_output, json_path);
+        if(ticks_per_millisecond > 0) lgs::setTimeMode(TIME_VIRTUAL, ticks_per_millisecond);
         std::string json_path_str(json_path);
 
-        // Enter NCURSES mode
-        lgs::initializeNcursesIO();
+        // Enter NCURSES mode, unless headless
+        if(headless) lgs::initializeHeadlessIO(char_output);
+        else lgs::initializeNcursesIO();
 
 
         lgs::print("Loading circuit json\n");
@@ -120,6 +257,13 @@ int main(int argc, char** argv)
         }
         const char* image_path = image_path_str.c_str();
         nlohmann::json peripherals_json = circuit_json["Peripherals"];
+        std::vector<Region> region_overrides;
+        if(circuit_json.find("Regions") != circuit_json.end())
+        {
+                if(engine_name.empty()) engine_name = "regions";
+                for(nlohmann::json::iterator i = circuit_json["Regions"].begin(); i != circuit_json["Regions"].end(); ++i)
+                        region_overrides.push_back(lgs::regionFromJson(*i));
+        }
         circuit_json_file.close();
 
         lgs::print("Loading image\n");
@@ -141,19 +285,26 @@ int main(int argc, char** argv)
         stbi_image_free(circuit_data_rgb);
         lgs::print("Loaded circuit\n");
 
-        std::vector<Peripheral*> peripherals;
-        peripherals.reserve(peripherals_json.size());
-        for(nlohmann::json::iterator i = peripherals_json.begin(); i != peripherals_json.end(); ++i)
-                peripherals.push_back(lgs::peripheralFromJson(*i));
+        PeripheralSet peripherals(peripherals_json);
         lgs::print("Loaded peripherals\n");
 
-        GifWriter out_writer;
         std::string out_path = std::string(json_path) + std::string(".out.gif");
-        GifBegin(&out_writer, out_path.c_str(), circuit_width * scale_factor, circuit_height * scale_factor, frametime);
+        if(output_view.w < 0) output_view.w = circuit_width - output_view.x;
+        if(output_view.h < 0) output_view.h = circuit_height - output_view.y;
+        if(output_view.x < 0 || output_view.y < 0 || output_view.w <= 0 || output_view.h <= 0 || output_view.x + output_view.w > circuit_width
+                        || output_view.y + output_view.h > circuit_height)
+        {
+                lgs::print("Output region is not inside the board.\n");
+                lgs::exitNcursesMode(true);
+        }
+        GifPipeline gif(out_path, circuit_width, output_view, frametime);
 
-        lgs::print("Press any key to start simulation.\n");
-        lgs::waitForKey();
-        lgs::clearScreen();
+        if(!headless)
+        {
+                lgs::print("Press any key to start simulation.\n");
+                lgs::waitForKey();
+                lgs::clearScreen();
+        }
 
 #ifdef LGS_PROFILE
         // Initialize for profiling
@@ -164,26 +315,113 @@ int main(int argc, char** argv)
 #endif
 
         // Start simulation
-        CPUWorker worker(circuit_data, circuit_width, circuit_height, peripherals);
+        EngineOptions engine_options;
+        bool tune_pending = false;                              // Set if the autotuner still has to benchmark, after LGS_AUTOTUNE_RUN_TICKS.
+        LaneSet input_lanes, output_lanes;
+        for(std::vector<Peripheral*>::const_iterator p = peripherals.getPeripherals().begin(); p != peripherals.getPeripherals().end(); ++p)
+        {
+                for(std::vector<Lane>::const_iterator l = (*p)->getInputLanes().begin(); l != (*p)->getInputLanes().end(); ++l)
+                        input_lanes.add(*l, circuit_width, circuit_height);
+                for(std::vector<Lane>::const_iterator l = (*p)->getOutputLanes().begin(); l != (*p)->getOutputLanes().end(); ++l)
+                        output_lanes.add(*l, circuit_width, circuit_height);
+        }
+        engine_options.observed = input_lanes.getPositions(circuit_width);
+        engine_options.observed.insert(engine_options.observed.end(), probes.begin(), probes.end());
+        engine_options.driven = output_lanes.getPositions(circuit_width);
+        engine_options.cone = cone_of_influence;
+        engine_options.regions = region_overrides;
+        engine_options.tile_size = LGS_REGION_TILE_SIZE;
+        engine_options.state = NULL;
+        if(autotune && (cone_of_influence || engine_name == std::string("xprop")))
+                lgs::print("WARNING: Autotuning is not supported with cone of influence or X propagation.\n");
+        else if(autotune)
+        {
+                TuneChoice choice;
+                if(lgs::cachedTuneChoice(circuit_data, circuit_width, circuit_height, lgs::defaultAutotuneCachePath(), choice))
+                {
+                        engine_name = choice.engine;
+                        engine_options.tile_size = choice.tile_size;
+                        std::stringstream str;
+                        str << "Using cached choice: " << engine_name << " engine with tile size " << choice.tile_size << "\n";
+                        lgs::print(str.str());
+                }
+                else tune_pending = true;
+        }
+        if(engine_name.empty()) engine_name = LGS_DEFAULT_ENGINE;
+        Engine* engine = lgs::engineFromName(engine_name, circuit_data, circuit_width, circuit_height, engine_options);
+        Simulation simulation(engine, circuit_width, circuit_height, peripherals, pipeline_depth);
+        if(headless) simulation.setLogStep(log_step);
         int n_ticks_out = 0;
-        uint8_t* frame = new uint8_t[circuit_width * circuit_height * 4 * scale_factor * scale_factor];
-        for(int i = 0; i != sim_length; i++)
+        Pacer pacer(tick_rate);
+        long int batch_left = 0;
+        int i = 0;
+        for(; i != sim_length; i++)
         {
+                if(batch_left == 0) batch_left = pacer.nextBatch();
 #ifdef LGS_PROFILE
                 tp1 = std::chrono::steady_clock::now();
 #endif
-                worker.tickSimulation();
+                // Jump over the idle ticks in one step, stopping short of the next tick with a capture or the end of the run
+                long int idle = simulation.getIdleTicks();
+                if(idle > 1)
+                {
+                        long int jump = idle == LONG_MAX ? LONG_MAX : idle - 1;
+                        bool wake_on_key = simulation.isWatchingKeys() && !headless;
+                        // An endless run that settled for good with nothing to wake it would only capture the same state again
+                        if(!(jump == LONG_MAX && sim_length < 0 && !wake_on_key))
+                        {
+                                if(sim_length >= 0 && sim_length - i - 1 < jump) jump = sim_length - i - 1;
+                                if(print_step > 0 && print_step - n_ticks_out - 1 < jump) jump = print_step - n_ticks_out - 1;
+                                if(tune_pending && LGS_AUTOTUNE_RUN_TICKS - i - 1 < jump) jump = LGS_AUTOTUNE_RUN_TICKS - i - 1;
+                        }
+                        if(jump >= batch_left)
+                        {
+                                // Sleep until the ticks are due or a key comes, unpaced only if nothing but a key can end the wait
+                                long int granted = pacer.skip(jump == LONG_MAX ? jump : jump - batch_left + 1, wake_on_key);
+                                if(granted < 0)
+                                {
+                                        lgs::print("The circuit settled with nothing left to wake it, ending the run\n");
+                                        break;
+                                }
+                                batch_left += granted;
+                                if(jump >= batch_left) jump = tick_rate > 0 ? batch_left - 1 : 0;
+                        }
+                        simulation.skipTicks(jump);
+                        i += jump;
+                        batch_left -= jump;
+                        n_ticks_out += jump;
+                        idle = simulation.getIdleTicks();
+                }
+                --batch_left;
+                if(idle > 0) simulation.skipTicks(1);
+                else simulation.tickSimulation();
 #ifdef LGS_PROFILE
                 tp2 = std::chrono::steady_clock::now();
                 tick_time += std::chrono::duration_cast<std::chrono::microseconds>(tp2-tp1);
 #endif
+                if(tune_pending && i + 1 == LGS_AUTOTUNE_RUN_TICKS)
+                {
+                        // Benchmark from the state the run has reached, then carry on in the fastest engine from that state
+                        tune_pending = false;
+                        lgs::print("Autotuning\n");
+                        TuneChoice choice = lgs::autotune(circuit_data, circuit_width, circuit_height, engine_options, simulation.getState(), 
+                                        lgs::defaultAutotuneCachePath());
+                        engine_options.tile_size = choice.tile_size;
+                        engine_options.state = simulation.getState();
+                        Engine* tuned = lgs::engineFromName(choice.engine, circuit_data, circuit_width, circuit_height, engine_options);
+                        engine_options.state = NULL;
+                        simulation.setEngine(tuned);
+                        delete engine;
+                        engine = tuned;
+                        std::stringstream str;
+                        str << "Fastest choice: " << choice.engine << " engine with tile size " << choice.tile_size << "\n";
+                        lgs::print(str.str());
+                }
                 n_ticks_out++;
                 if(n_ticks_out == print_step)
                 {
                         n_ticks_out = 0;
-                        const bool* state = worker.getState();
-                        lgs::stateToFrame(frame, state, circuit_width, circuit_height, scale_factor);
-                        GifWriteFrame(&out_writer, frame, circuit_width * scale_factor, circuit_height * scale_factor, frametime);
+                        gif.capture(simulation.getState(), engine->getKnown(), engine->getMask());
                 }
 #ifdef LGS_PROFILE
                 tp2 = std::chrono::steady_clock::now();
@@ -204,13 +442,19 @@ int main(int argc, char** argv)
                 }
 #endif
         }
-        const bool* state = worker.getState();
-        lgs::stateToFrame(frame, state, circuit_width, circuit_height, scale_factor);
-        GifWriteFrame(&out_writer, frame, circuit_width * scale_factor, circuit_height * scale_factor, frametime);
-        delete[] frame;
+        gif.capture(simulation.getState(), engine->getKnown(), engine->getMask());
+        simulation.drain();
+        peripherals.finish();
+        lgs::logPrintSections(i);
+        lgs::print(engine->getReport());
+        lgs::print(pacer.getReport());
+        if(simulation.getSkippedTicks() > 0)
+                lgs::print("Skipped " + std::to_string(simulation.getSkippedTicks()) + " idle ticks\n");
+        delete engine;
         lgs::print("Finished simulation\n");
 
-        GifEnd(&out_writer);
+        gif.finish();
+        lgs::print(gif.getReport());
         lgs::exitNcursesMode(false);
 
         return EXIT_SUCCESS;
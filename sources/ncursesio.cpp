@@ -3,21 +3,267 @@
  */
 
 #include <ncurses.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
 #include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <string>
 
+#include <spscqueue.hpp>
 #include <logicsim.hpp>
 
 #include <ncursesio.hpp>
 
 
 // For key tracking
-std::chrono::steady_clock::time_point last_update;
-bool key_states[256];
-bool is_key_pressed;
+const int n_key_codes = KEY_MAX + 1;    // Byte keys, then the ncurses keypad codes.
+struct KeyEvent
+{
+        long int tick;                  // Tick at which the event was read.
+        int key;
+        bool down;
+};
+std::vector<std::pair<std::string, int>> key_sequences;        // Escape sequence of each keypad key, from the terminfo of the terminal.
+lgs::SPSCQueue<KeyEvent>* key_events = NULL;
+std::thread input_thread;
+std::atomic<bool> input_running(false);
+std::atomic<long int> input_tick(0);
+std::mutex key_lock;                    // Only taken to wait on key_pushed.
+std::condition_variable key_pushed;
+bool key_states[n_key_codes];           // Snapshot, owned by the consumer of key_events.
+int n_keys_pressed;
 
-// For print sections
+// For the screen, all but drawn guarded by screen_lock
+std::mutex screen_lock;
 lgs::PrintSection* head = NULL;
-bool is_empty = true;
+std::vector<std::string> log_lines(1);  // Lines printed to the bottom of the screen, the last one being the current one.
+bool screen_dirty = false;
+bool screen_clear = false;              // Redraw all lines, not just the changed ones.
+std::vector<std::string> drawn;         // Lines on the terminal, owned by the UI thread.
+std::thread ui_thread;
+std::atomic<bool> ui_running(false);
+
+// For headless mode
+bool headless = false;
+FILE* output_sink = NULL;
+
+/*
+ * Returns the length of the longest escape sequence in key_sequences that input starts with, and sets code to its key, or returns 0 
+ * if there is none. Sets partial to whether input is a proper prefix of some sequence, so more bytes may complete it.
+ */
+std::string::size_type match_sequence(const std::string& input, int& code, bool& partial)
+{
+        std::string::size_type best = 0;
+        partial = false;
+        for(std::vector<std::pair<std::string, int>>::const_iterator s = key_sequences.begin(); s != key_sequences.end(); ++s)
+        {
+                if(s->first.size() > best && input.compare(0, s->first.size(), s->first) == 0)
+                {
+                        best = s->first.size();
+                        code = s->second;
+                }
+                else if(s->first.size() > input.size() && s->first.compare(0, input.size(), input) == 0) partial = true;
+        }
+        return best;
+}
+
+/*
+ * Body of the input thread. Reads bytes from the terminal, decoding the escape sequences of keypad keys into the ncurses key codes 
+ * getch() would give, and queues a key down event for each key not already down, and a key up event for each key not seen for 
+ * LGS_KEYBOARD_WAIT_TIME. Events that do not fit in the queue are held back and pushed later, in order, but key presses are dropped
+ * while LGS_KEY_QUEUE_SIZE events are held back, so the backlog stays bounded when nothing takes events. Stops reading once the 
+ * terminal hangs up or stdin ends.
+ */
+void run_input()
+{
+        const std::chrono::steady_clock::duration release_time = std::chrono::milliseconds(LGS_KEYBOARD_WAIT_TIME);
+        std::chrono::steady_clock::time_point last_seen[n_key_codes];
+        bool down[n_key_codes];
+        for(int i = 0; i < n_key_codes; i++) down[i] = false;
+        std::vector<KeyEvent> pending;
+        std::string input;                      // Bytes read and not yet decoded, only ever the start of an escape sequence.
+        std::chrono::steady_clock::time_point input_time;
+        char buffer[64];
+        struct pollfd fd;
+        fd.fd = STDIN_FILENO;
+        fd.events = POLLIN;
+        while(input_running)
+        {
+                // A negative fd is ignored by poll, which then just waits
+                if(poll(&fd, 1, LGS_KEYBOARD_WAIT_TIME) > 0)
+                {
+                        int n = (fd.revents & POLLIN) ? read(STDIN_FILENO, buffer, sizeof(buffer)) : 0;
+                        if(n > 0)
+                        {
+                                if(input.empty()) input_time = std::chrono::steady_clock::now();
+                                input.append(buffer, n);
+                        }
+                        else if(n == 0 || (errno != EINTR && errno != EAGAIN)) fd.fd = -1;
+                }
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                long int tick = input_tick.load(std::memory_order_relaxed);
+                std::string::size_type i = 0;
+                while(i < input.size())
+                {
+                        int code = (unsigned char) input[i];
+                        std::string::size_type length = 1;
+                        if(code == 27)
+                        {
+                                bool partial;
+                                std::string::size_type matched = match_sequence(input.substr(i), code, partial);
+                                if(matched > 0) length = matched;
+                                else if(partial && fd.fd >= 0 && now - input_time <= release_time) break;
+                        }
+                        i += length;
+                        last_seen[code] = now;
+                        if(!down[code] && pending.size() < LGS_KEY_QUEUE_SIZE)
+                        {
+                                down[code] = true;
+                                pending.push_back({tick, code, true});
+                        }
+                }
+                input.erase(0, i);
+                for(int k = 0; k < n_key_codes; k++)
+                        if(down[k] && now - last_seen[k] > release_time)
+                        {
+                                down[k] = false;
+                                pending.push_back({tick, k, false});
+                        }
+                if(!pending.empty())
+                {
+                        std::size_t pushed = key_events->pushSome(pending.data(), pending.size());
+                        pending.erase(pending.begin(), pending.begin() + pushed);
+                        if(pushed > 0)
+                        {
+                                // Taking the lock orders the push before the check of a waiter that is about to sleep
+                                { std::lock_guard<std::mutex> lock(key_lock); }
+                                key_pushed.notify_all();
+                        }
+                }
+        }
+}
+
+/*
+ * Stops the input thread, if it is running.
+ */
+void stop_input()
+{
+        if(!input_running) return;
+        input_running = false;
+        input_thread.join();
+}
+
+/*
+ * Draws the screen on the UI thread. The print sections come first, each followed by a line of dashes, and the printed lines fill 
+ * the bottom of what is left. Only the lines that differ from what is on the terminal are drawn.
+ */
+class lgs::Compositor
+{
+        public:
+                static void run()
+                {
+                        while(ui_running)
+                        {
+                                frame();
+                                std::this_thread::sleep_for(std::chrono::milliseconds(LGS_SCREEN_FRAME_TIME));
+                        }
+                }
+
+                /*
+                 * Draws one frame if the screen is dirty. The lock is only held to copy the text out.
+                 */
+                static void frame()
+                {
+                        int rows, cols;
+                        getmaxyx(stdscr, rows, cols);
+                        if(rows <= 0 || cols <= 0) return;
+                        std::vector<std::string> sections, log;
+                        bool clear;
+                        {
+                                std::lock_guard<std::mutex> lock(screen_lock);
+                                if(!screen_dirty) return;
+                                for(PrintSection* sec = head; sec != NULL; sec = sec->next)
+                                        sections.push_back(sec->text);
+                                if(log_lines.size() > (std::vector<std::string>::size_type) rows)
+                                        log_lines.erase(log_lines.begin(), log_lines.end() - rows);
+                                log = log_lines;
+                                clear = screen_clear;
+                                screen_dirty = false;
+                                screen_clear = false;
+                        }
+
+                        std::vector<std::string> screen;
+                        for(std::vector<std::string>::size_type i = 0; i < sections.size(); i++)
+                        {
+                                wrap(sections[i], cols, screen);
+                                screen.push_back(std::string(cols, '-'));
+                        }
+                        if(screen.size() > (std::vector<std::string>::size_type) rows)
+                                screen.resize(rows);
+                        std::vector<std::string> log_screen;
+                        for(std::vector<std::string>::size_type i = 0; i < log.size(); i++)
+                                wrap(log[i], cols, log_screen);
+                        std::vector<std::string>::size_type free_rows = rows - screen.size();
+                        if(log_screen.size() > free_rows)
+                                log_screen.erase(log_screen.begin(), log_screen.end() - free_rows);
+                        screen.resize(rows - log_screen.size());
+                        screen.insert(screen.end(), log_screen.begin(), log_screen.end());
+
+                        if(clear || drawn.size() != screen.size())
+                        {
+                                erase();
+                                drawn.assign(screen.size(), std::string());
+                        }
+                        for(int r = 0; r < rows; r++)
+                                if(screen[r] != drawn[r])
+                                {
+                                        mvaddnstr(r, 0, screen[r].c_str(), cols);
+                                        if((int) screen[r].size() < cols) clrtoeol();
+                                        drawn[r].swap(screen[r]);
+                                }
+                        refresh();
+                }
+
+                /*
+                 * Splits text into lines at newlines and at the screen width, appending them to lines.
+                 */
+                static void wrap(const std::string& text, int cols, std::vector<std::string>& lines)
+                {
+                        std::string::size_type begin = 0;
+                        while(true)
+                        {
+                                std::string::size_type end = text.find('\n', begin);
+                                if(end == std::string::npos) end = text.size();
+                                do
+                                {
+                                        std::string::size_type n = end - begin < (std::string::size_type) cols ? end - begin : cols;
+                                        lines.push_back(text.substr(begin, n));
+                                        begin += n;
+                                } while(begin < end);
+                                if(end == text.size()) break;
+                                begin = end + 1;
+                        }
+                }
+};
+
+/*
+ * Stops the UI thread, if it is running, and draws the last frame.
+ */
+void stop_ui()
+{
+        if(!ui_running) return;
+        ui_running = false;
+        ui_thread.join();
+        lgs::Compositor::frame();
+}
 
 void lgs::initializeNcursesIO()
 {
@@ -30,177 +276,257 @@ void lgs::initializeNcursesIO()
         scrollok(stdscr, TRUE);
         curs_set(0);
 
-        // Keypress detection
-        is_key_pressed = false;
-        last_update = std::chrono::steady_clock::now();
-        for(int i = 0; i < 256; ++i)
+        // Keypress detection. The input thread reads the terminal itself, so ncurses must not look for typeahead while refreshing.
+        typeahead(-1);
+        for(int code = KEY_MIN; code <= KEY_MAX; code++)
+                for(int count = 0; ; count++)
+                {
+                        char* sequence = keybound(code, count);
+                        if(sequence == NULL) break;
+                        if(sequence[0] == 27 && sequence[1] != 0) key_sequences.push_back(std::make_pair(std::string(sequence), code));
+                        // Terminals not switched to application mode send the same keys with [ in place of O
+                        if(sequence[0] == 27 && sequence[1] == 'O' && sequence[2] != 0)
+                                key_sequences.push_back(std::make_pair("\033[" + std::string(sequence + 2), code));
+                        free(sequence);
+                }
+        n_keys_pressed = 0;
+        for(int i = 0; i < n_key_codes; ++i)
                 key_states[i] = false;
+        key_events = new lgs::SPSCQueue<KeyEvent>(LGS_KEY_QUEUE_SIZE);
+        input_running = true;
+        input_thread = std::thread(run_input);
 
-        // Print sections
-        int max_l, max_c;
-        getmaxyx(stdscr, max_l, max_c);
-        printw(std::string(max_l+1, '\n').c_str());
-        refresh();
+        // Screen
+        scrollok(stdscr, FALSE);
+        screen_clear = true;
+        screen_dirty = true;
+        ui_running = true;
+        ui_thread = std::thread(lgs::Compositor::run);
 }
 
-void update_key_states()
+void lgs::initializeHeadlessIO(const char* outputPath)
 {
-        int code;
-        if(std::chrono::steady_clock::now() - last_update >
-                        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(LGS_KEYBOARD_WAIT_TIME)))
+        headless = true;
+        output_sink = outputPath != NULL ? fopen(outputPath, "w") : stdout;
+        if(output_sink == NULL)
         {
-                is_key_pressed = false;
-                for(int i = 0; i < 256; i++) key_states[i] = false;
-                while((code = getch()) != ERR)
-                {
-                        key_states[code] = true;
-                        is_key_pressed = true;
-                }
-                last_update = std::chrono::steady_clock::now();
+                fprintf(stderr, "Failed to open output file %s\n", outputPath);
+                exit(EXIT_FAILURE);
+        }
+        setvbuf(output_sink, NULL, _IOFBF, LGS_HEADLESS_BUFFER_SIZE);
+}
+
+bool lgs::isHeadless() { return headless; }
+
+bool lgs::updateKeySnapshot(long int tick)
+{
+        if(key_events == NULL) return false;
+        input_tick.store(tick, std::memory_order_relaxed);
+        bool changed = false;
+        KeyEvent event;
+        while(key_events->pop(event))
+        {
+                if(key_states[event.key] == event.down) continue;
+                n_keys_pressed += event.down ? 1 : -1;
+                key_states[event.key] = event.down;
+                changed = true;
         }
+        return changed;
+}
+
+bool lgs::isKeyEventPending() { return key_events != NULL && key_events->size() > 0; }
+
+void lgs::setKeyTick(long int tick) { input_tick.store(tick, std::memory_order_relaxed); }
+
+bool lgs::waitForKeyEvent(std::chrono::steady_clock::time_point deadline)
+{
+        if(key_events == NULL)
+        {
+                if(deadline != std::chrono::steady_clock::time_point::max()) std::this_thread::sleep_until(deadline);
+                return false;
+        }
+        std::unique_lock<std::mutex> lock(key_lock);
+        if(deadline == std::chrono::steady_clock::time_point::max())
+        {
+                while(!isKeyEventPending()) key_pushed.wait(lock);
+                return true;
+        }
+        return key_pushed.wait_until(lock, deadline, isKeyEventPending);
 }
 
 bool lgs::getKeyState(int key)
 {
-        update_key_states();
-        return key_states[key];
+        return key >= 0 && key < n_key_codes && key_states[key];
 }
 
 bool lgs::isAnyKeyPressed()
 {
-        update_key_states();
-        return is_key_pressed;
+        return n_keys_pressed > 0;
 }
 
 int lgs::getAnyPressedKey()
 {
-       update_key_states();
-       int ret = -1;
-       for(int i = 0; i < 256; i++)
+       if(n_keys_pressed == 0) return -1;
+       for(int i = 0; i < n_key_codes; i++)
               if(key_states[i])
-              {
-                      ret = i;
-                      break;
-              }
-       return ret;
+                      return i;
+       return -1;
 }
 
-void lgs::waitForKey() { while(getch() == ERR); }
+void lgs::waitForKey() 
+{ 
+        if(headless) return;
+        KeyEvent event;
+        while(!key_events->pop(event) || !event.down)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        key_states[event.key] = true;
+        ++n_keys_pressed;
+}
+
+/*
+ * Appends printed text to the log lines. Called with screen_lock held.
+ */
+void append_log(const std::string& str)
+{
+        for(std::string::size_type i = 0; i < str.size(); i++)
+        {
+                if(str[i] == '\n') log_lines.push_back(std::string());
+                else log_lines.back() += str[i];
+        }
+        screen_dirty = true;
+}
 
 void lgs::print(const std::string& str) 
 { 
-        printw(str.c_str()); 
-        refresh();
+        if(headless)
+        {
+                fputs(str.c_str(), stderr);
+                return;
+        }
+        std::lock_guard<std::mutex> lock(screen_lock);
+        append_log(str);
 }
 
-void lgs::PrintSection::print_update_next()
+void lgs::printOutput(const std::string& str)
 {
-        int l, c, max_l, max_c;
-        getmaxyx(stdscr, max_l, max_c);
-        getyx(stdscr, l, c);
-        beg_lin = l;
-        printw(text.c_str());
-        printw("\n");
-        printw(std::string(max_c, '-').c_str());
-        printw("\n");
-        refresh();
-        if(!is_end) next->print_update_next();
-        return;
+        if(headless) fwrite(str.data(), 1, str.size(), output_sink);
+        else print(str);
 }
 
-void lgs::PrintSection::print_update()
+void lgs::logPrintSections(long int tick)
 {
-        int l, c;
-        getyx(stdscr, l, c);
-        move(beg_lin, 0);
-        print_update_next();
-        move(l, c);
+        if(!headless) return;
+        std::lock_guard<std::mutex> lock(screen_lock);
+        // With no UI thread in headless mode, screen_dirty tells whether anything changed since the last log
+        if(!screen_dirty) return;
+        screen_dirty = false;
+        for(PrintSection* sec = head; sec != NULL; sec = sec->next)
+                if(sec->text != sec->logged)
+                {
+                        sec->logged = sec->text;
+                        fprintf(stderr, "%ld: %s", tick, sec->text.c_str());
+                        if(sec->text.empty() || sec->text[sec->text.size() - 1] != '\n') fputc('\n', stderr);
+                }
 }
 
 lgs::PrintSection::PrintSection()
 {
+        std::lock_guard<std::mutex> lock(screen_lock);
         next = head;
-        is_end = is_empty;
-        is_empty = false;
         head = this;
-        beg_lin = 0;
-        text = "";
+        screen_dirty = true;
 }
 
 lgs::PrintSection::PrintSection(PrintSection* section)
 {
+        std::lock_guard<std::mutex> lock(screen_lock);
         next = section->next;
         section->next = this;
-        is_end = next->is_end;
-        beg_lin = 0;
-        text = "";
-        section->print_update();
+        screen_dirty = true;
 }
 
 void lgs::PrintSection::addToEnd(const std::string& str)
 {
+        std::lock_guard<std::mutex> lock(screen_lock);
         text += str;
-        print_update();
+        screen_dirty = true;
 }
 
 void lgs::PrintSection::setText(const std::string& str)
 {
+        std::lock_guard<std::mutex> lock(screen_lock);
+        if(text == str) return;
         text = str;
-        print_update();
+        screen_dirty = true;
 }
 
 void lgs::PrintSection::addToEnd(const std::string&& str)
 {
+        std::lock_guard<std::mutex> lock(screen_lock);
         text += str;
-        print_update();
+        screen_dirty = true;
 }
 
 void lgs::PrintSection::setText(const std::string&& str)
 {
+        std::lock_guard<std::mutex> lock(screen_lock);
+        if(text == str) return;
         text = str;
-        print_update();
+        screen_dirty = true;
 }
 
 void lgs::PrintSection::addBackspace(size_t n)
 {
+        std::lock_guard<std::mutex> lock(screen_lock);
         n = text.size() < n ? text.size() : n;
         text.erase(text.end() - n, text.end());
-        print_update();
+        screen_dirty = true;
 }
 
-void lgs::PrintSection::reprint() { print_update(); }
+void lgs::PrintSection::reprint() 
+{ 
+        std::lock_guard<std::mutex> lock(screen_lock);
+        screen_dirty = true;
+}
 
 void lgs::backspace()
 {
-        int y, x;
-        getyx(stdscr, y, x);
-        if(x == 0) return;
-        move(y, x-1);
-        printw(" ");
-        move(y, x-1);
-        refresh();
+        if(headless)
+        {
+                fputc('\b', output_sink);
+                return;
+        }
+        std::lock_guard<std::mutex> lock(screen_lock);
+        if(log_lines.back().empty()) return;
+        log_lines.back().erase(log_lines.back().size() - 1);
+        screen_dirty = true;
 }
 
 void lgs::clearScreen()
 { 
-        erase();
-        refresh();
-        int max_l, max_c;
-        getmaxyx(stdscr, max_l, max_c);
-        printw(std::string(max_l+1, '\n').c_str());
-        refresh();
-        if(!is_empty) head->reprint();
+        std::lock_guard<std::mutex> lock(screen_lock);
+        log_lines.assign(1, std::string());
+        screen_clear = true;
+        screen_dirty = true;
 }
 
 void lgs::exitNcursesMode(bool err)
 {
+        if(headless)
+        {
+                fflush(output_sink);
+                if(output_sink != stdout) fclose(output_sink);
+                if(err) fputs("Critical error occured in LogicSim.\n", stderr);
+                exit(err ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+        stop_input();
         if(err)
         {
-            printw("Critical error occured in LogicSim, press any key to exit.");
-            refresh();
+            print("Critical error occured in LogicSim, press any key to exit.");
+            stop_ui();
             while(getch() == ERR);
         }
+        stop_ui();
         endwin();
-        exit(EXIT_FAILURE);
+        exit(err ? EXIT_FAILURE : EXIT_SUCCESS);
 }
-
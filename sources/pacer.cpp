@@ -0,0 +1,83 @@
+/*
+ * Implementation for pacer.hpp
+ */
+
+#include <chrono>
+#include <thread>
+#include <string>
+#include <sstream>
+#include <climits>
+
+#include <logicsim.hpp>
+#include <ncursesio.hpp>
+
+#include <pacer.hpp>
+
+lgs::Pacer::Pacer(double ticksPerSecond) : rate(ticksPerSecond), n_ticks(0), n_batches(0), n_late(0), slept(0)
+{
+        max_batch = (long int) (rate * LGS_PACER_BATCH_TIME / 1000);
+        if(max_batch < 1) max_batch = 1;
+        start = began = std::chrono::steady_clock::now();
+}
+
+int lgs::Pacer::nextBatch()
+{
+        if(rate <= 0) return LGS_PACER_FREE_BATCH;
+        ++n_batches;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        long int due = (long int) (std::chrono::duration<double>(now - start).count() * rate) + 1 - n_ticks;
+        if(due < max_batch)
+        {
+                // Ahead of schedule, sleep until a whole batch is due
+                std::chrono::steady_clock::time_point wake = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                std::chrono::duration<double>((n_ticks + max_batch - 1) / rate));
+                std::this_thread::sleep_until(wake);
+                slept += std::chrono::steady_clock::now() - now;
+                due = max_batch;
+        }
+        else if(due > max_batch + (long int) (rate * LGS_PACER_MAX_LAG / 1000))
+        {
+                // Too far behind, move the schedule up
+                start = now - std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                std::chrono::duration<double>(n_ticks / rate));
+                ++n_late;
+                due = 1;
+        }
+        if(due > max_batch) due = max_batch;
+        n_ticks += due;
+        return (int) due;
+}
+
+long int lgs::Pacer::skip(long int ticks, bool wakeOnKey)
+{
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+        if(ticks == LONG_MAX && !wakeOnKey) return -1;
+        if(rate <= 0 && ticks != LONG_MAX) return ticks;
+        if(rate > 0 && ticks != LONG_MAX)
+                deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                std::chrono::duration<double>((n_ticks + ticks - 1) / rate));
+        if(wakeOnKey) lgs::waitForKeyEvent(deadline);
+        else std::this_thread::sleep_until(deadline);
+        if(rate <= 0) return 0;
+
+        std::chrono::steady_clock::time_point woke = std::chrono::steady_clock::now();
+        slept += woke - now;
+        long int due = (long int) (std::chrono::duration<double>(woke - start).count() * rate) + 1 - n_ticks;
+        if(due < 0) due = 0;
+        if(due > ticks) due = ticks;
+        n_ticks += due;
+        return due;
+}
+
+std::string lgs::Pacer::getReport()
+{
+        if(rate <= 0) return "";
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+        std::stringstream str;
+        str << "Paced at " << (elapsed > 0 ? n_ticks / elapsed : 0) << " of " << rate << " ticks per second in " << n_batches 
+                << " batches, sleeping " << std::chrono::duration_cast<std::chrono::milliseconds>(slept).count() << " ms";
+        if(n_late > 0) str << ", fell behind " << n_late << " times";
+        str << "\n";
+        return str.str();
+}
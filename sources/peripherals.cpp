@@ -8,25 +8,202 @@
 #include <chrono>
 #include <string>
 #include <sstream>
+#include <map>
+#include <algorithm>
+#include <cerrno>
+#include <thread>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 
 #include <json.hpp>
 
 #include <ncursesio.hpp>
+#include <lane.hpp>
+#include <filestream.hpp>
+#include <seriallink.hpp>
+#include <timesource.hpp>
+#include <logicsim.hpp>
 
 #include <peripherals.hpp>
 
 using namespace lgs;
 
 
-LEDArray::LEDArray(const nlohmann::json& initJson) : Peripheral(initJson)
+int Peripheral::addInputLane(const Lane& lane)
+{
+        input_lanes.push_back(lane);
+        return (int) input_lanes.size() - 1;
+}
+
+int Peripheral::addOutputLane(const Lane& lane)
+{
+        output_lanes.push_back(lane);
+        return (int) output_lanes.size() - 1;
+}
+
+void Peripheral::finish() {}
+
+const std::vector<Lane>& Peripheral::getInputLanes() const { return input_lanes; }
+
+const std::vector<Lane>& Peripheral::getOutputLanes() const { return output_lanes; }
+
+void Peripheral::watchInputLane(int lane)
+{
+        watched_lanes.push_back(lane);
+        polling = false;
+}
+
+void Peripheral::stopPolling() { polling = false; }
+
+void Peripheral::watchKeys()
+{
+        watching_keys = true;
+        polling = false;
+}
+
+bool Peripheral::isWatchingKeys() const { return watching_keys; }
+
+bool Peripheral::isPolling() const { return polling; }
+
+void Peripheral::wakeAfter(int ticks) { wake_after = ticks; }
+
+const std::vector<int>& Peripheral::getWatchedLanes() const { return watched_lanes; }
+
+long int Peripheral::getTickNumber() const { return tick_number; }
+
+int Peripheral::takeWakeRequest()
+{
+        int ticks = wake_after;
+        wake_after = 0;
+        return ticks;
+}
+
+void Peripheral::fail(const std::string& message)
+{
+        // Ticks may run on the peripheral thread, so the Simulation reports the error and exits from the main thread
+        if(error.empty()) error = message;
+}
+
+const std::string& Peripheral::getError() const { return error; }
+
+
+ProcessPeripheral::ProcessPeripheral(const nlohmann::json& initJson) : Peripheral(initJson), wait_kind(WAIT_NONE), wait_lane(0), 
+        wait_bit(0), wait_until(0), in_words(NULL), resume_point(0) {}
+
+int ProcessPeripheral::addInputLane(const Lane& lane, bool watched)
 {
-        // Initialize from JSON
+        int index = Peripheral::addInputLane(lane);
+        if(watched) watchInputLane(index);
+        prev_words.push_back(0);
+        lane_watched.push_back(watched);
+        return index;
+}
+
+int ProcessPeripheral::addOutputLane(const Lane& lane)
+{
+        out_words.push_back(0);
+        out_driven.push_back(false);
+        return Peripheral::addOutputLane(lane);
+}
+
+void ProcessPeripheral::wait_for(WaitKind kind, int lane, LaneWord bit)
+{
+        if(!lane_watched[lane])
+        {
+                fail("Process peripheral waits on an unwatched input lane\n");
+                kind = WAIT_FOREVER;
+        }
+        wait_kind = kind;
+        wait_lane = lane;
+        wait_bit = bit;
+}
+
+void ProcessPeripheral::waitFallingEdge(int lane, int bit) { wait_for(WAIT_FALLING, lane, (LaneWord) 1 << bit); }
+
+void ProcessPeripheral::waitRisingEdge(int lane, int bit) { wait_for(WAIT_RISING, lane, (LaneWord) 1 << bit); }
+
+void ProcessPeripheral::waitChange(int lane) { wait_for(WAIT_CHANGE, lane, ~(LaneWord) 0); }
+
+void ProcessPeripheral::waitTicks(int ticks)
+{
+        wait_kind = WAIT_TICKS;
+        wait_until = getTickNumber() + (ticks > 1 ? ticks : 1);
+}
+
+void ProcessPeripheral::waitForever() { wait_kind = WAIT_FOREVER; }
+
+LaneWord ProcessPeripheral::readLane(int lane) const { return in_words[lane]; }
+
+void ProcessPeripheral::writeLane(int lane, LaneWord value)
+{
+        out_words[lane] = value;
+        out_driven[lane] = true;
+}
+
+void ProcessPeripheral::releaseLane(int lane) { out_driven[lane] = false; }
+
+void ProcessPeripheral::tick(const LaneWord* in, LaneWord* out, bool* drive)
+{
+        bool over = false;
+        switch(wait_kind)
+        {
+                case WAIT_NONE: over = true; break;
+                case WAIT_FALLING: over = (prev_words[wait_lane] & wait_bit) && !(in[wait_lane] & wait_bit); break;
+                case WAIT_RISING: over = !(prev_words[wait_lane] & wait_bit) && (in[wait_lane] & wait_bit); break;
+                case WAIT_CHANGE: over = in[wait_lane] != prev_words[wait_lane]; break;
+                case WAIT_TICKS: over = getTickNumber() >= wait_until; break;
+                case WAIT_FOREVER: over = false; break;
+        }
+        if(over)
+        {
+                in_words = in;
+                run();
+                in_words = NULL;
+        }
+        if(wait_kind == WAIT_TICKS) wakeAfter((int) (wait_until - getTickNumber()));
+
+        for(std::vector<LaneWord>::size_type i = 0; i < prev_words.size(); i++)
+                prev_words[i] = in[i];
+        for(std::vector<LaneWord>::size_type i = 0; i < out_words.size(); i++)
+        {
+                out[i] = out_words[i];
+                drive[i] = out_driven[i];
+        }
+}
+
+
+LEDArray::LEDArray(const nlohmann::json& initJson) : Peripheral(initJson), pending(true), rate_limited(!lgs::isHeadless())
+{
+        // Initialize from JSON, packing the LEDs into lanes of LGS_LANE_MAX_BITS
+        std::vector<std::pair<int, int>> led_pos;
         for(nlohmann::json::const_iterator led = initJson.begin(); led != initJson.end(); ++led)
         {
                 led_pos.push_back(std::pair<int, int>((*led)["X"].get<int>(), (*led)["Y"].get<int>()));
                 led_labels.push_back((*led)["Label"].get<std::string>());
+                if(led_pos.size() == LGS_LANE_MAX_BITS)
+                {
+                        addInputLane(Lane(led_pos));
+                        led_pos.clear();
+                }
+        }
+        if(!led_pos.empty()) addInputLane(Lane(led_pos));
+        for(int i = 0; i < (int) getInputLanes().size(); i++)
+                watchInputLane(i);
+
+        // Lay out the text once, with every LED off
+        text = "LEDs: ";
+        for(size_t i = 0; i < led_labels.size(); ++i)
+        {
+                text += led_labels[i];
+                state_index.push_back(text.size());
+                text += '0';
         }
+        text += '\n';
+        words.assign(getInputLanes().size(), 0);
 
 #ifndef LGS_DEBUG_LEDARRAY_OFF
         // Get PrintSection
@@ -34,115 +211,583 @@ LEDArray::LEDArray(const nlohmann::json& initJson) : Peripheral(initJson)
 #endif
 }
 
-void LEDArray::tick(const bool* stateR, bool* stateW, int w, int h) 
+void LEDArray::tick(const LaneWord* in, LaneWord* out, bool* drive) 
 {
-        std::stringstream str;
-        str << "LEDs: ";
-        for(size_t i = 0; i < led_pos.size(); ++i)
+        for(std::vector<LaneWord>::size_type i = 0; i < words.size(); i++)
+        {
+                LaneWord changed = in[i] ^ words[i];
+                if(changed == 0) continue;
+                words[i] = in[i];
+                pending = true;
+                for(int bit = 0; changed != 0; bit++, changed >>= 1)
+                        if(changed & 1)
+                                text[state_index[i * LGS_LANE_MAX_BITS + bit]] = ((in[i] >> bit) & 1) ? '1' : '0';
+        }
+        if(!pending) return;
+
+        // Publish, or come back next tick if the last update was too recent
+        if(rate_limited)
         {
-                str << led_labels[i];
-                if(0 <= led_pos[i].first && led_pos[i].first < w && 0 <= led_pos[i].second && led_pos[i].second < h)
-                        str << (stateR[led_pos[i].second*w + led_pos[i].first] ? "1" : "0");
-                else str << "0";
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                if(now - last_update < std::chrono::milliseconds(LGS_LEDARRAY_UPDATE_TIME))
+                {
+                        wakeAfter(1);
+                        return;
+                }
+                last_update = now;
         }
-        str << "\n";
-        
-        
+        pending = false;
 #ifndef LGS_DEBUG_LEDARRAY_OFF
-        section->setText(str.str());
+        section->setText(text);
+#endif
+}
+
+void LEDArray::finish()
+{
+        if(!pending) return;
+        pending = false;
+#ifndef LGS_DEBUG_LEDARRAY_OFF
+        section->setText(text);
 #endif
 }
 
 BitSwitchArray::BitSwitchArray(const nlohmann::json& initJson) : Peripheral(initJson)
 {
+        std::vector<std::pair<int, int>> switch_pos;
         for(nlohmann::json::const_iterator sw = initJson.begin(); sw != initJson.end(); ++sw)
         {
                 switch_pos.push_back(std::pair<int, int>((*sw)["X"].get<int>(), (*sw)["Y"].get<int>()));
                 keys.push_back((*sw)["Key"].get<int>());
+                if(switch_pos.size() == LGS_LANE_MAX_BITS)
+                {
+                        addOutputLane(Lane(switch_pos));
+                        switch_pos.clear();
+                }
         }
+        if(!switch_pos.empty()) addOutputLane(Lane(switch_pos));
+        watchKeys();
 }
 
-void BitSwitchArray::tick(const bool* stateR, bool* stateW, int w, int h)
+void BitSwitchArray::tick(const LaneWord* in, LaneWord* out, bool* drive)
 {
         for(std::vector<int>::size_type i = 0; i < keys.size(); i++)
-               stateW[w*switch_pos[i].second + switch_pos[i].first] = getKeyState(keys[i]);
+        {
+                if(i % LGS_LANE_MAX_BITS == 0)
+                {
+                        out[i / LGS_LANE_MAX_BITS] = 0;
+                        drive[i / LGS_LANE_MAX_BITS] = true;
+                }
+                if(getKeyState(keys[i])) out[i / LGS_LANE_MAX_BITS] |= (LaneWord) 1 << (i % LGS_LANE_MAX_BITS);
+        }
 }
 
-Clock::Clock(const nlohmann::json& initJson) : Peripheral(initJson)
+Clock::Clock(const nlohmann::json& initJson) : Peripheral(initJson), period_ticks(0), state(false), next_toggle(0)
 {
-        x = initJson["X"].get<int>();
-        y = initJson["Y"].get<int>();
-        period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
-                        std::chrono::milliseconds(initJson["Period"].get<int>()));
-        state = false;
+        addOutputLane(laneFromJson(initJson));
+        bool in_ticks = initJson.find("Period ticks") != initJson.end();
+        long int given = in_ticks ? initJson["Period ticks"].get<long int>() : initJson["Period"].get<int>();
+        if(given <= 0)
+        {
+                lgs::print(in_ticks ? "Clock period ticks must be positive\n" : "Clock period must be positive\n");
+                lgs::exitNcursesMode(true);
+        }
+        if(in_ticks)
+                period_ticks = given;
+        else if(lgs::getTimeMode() == TIME_VIRTUAL)
+                period_ticks = lgs::virtualMillisecondsToTicks(given);
+        else
+                period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(given));
+        if(period_ticks > 0)
+        {
+                stopPolling();
+                next_toggle = period_ticks;
+        }
         previous = std::chrono::steady_clock::now();
 }
 
-void Clock::tick(const bool* stateR, bool* stateW, int w, int h)
+void Clock::tick(const LaneWord* in, LaneWord* out, bool* drive)
 {
-        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
-        if(now - previous > period)
+        if(period_ticks > 0)
         {
-                previous = now;
-                state = !state;
+                if(getTickNumber() >= next_toggle)
+                {
+                        state = !state;
+                        next_toggle += period_ticks;
+                }
+                wakeAfter((int) (next_toggle - getTickNumber()));
         }
-        stateW[y*w + x] = state;
+        else
+        {
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                if(now - previous > period)
+                {
+                        previous = now;
+                        state = !state;
+                }
+        }
+        out[0] = state ? ~(LaneWord) 0 : 0;
+        drive[0] = true;
 }
 
 Keyboard::Keyboard(const nlohmann::json& init_json) : Peripheral(init_json)
 {
-        key_pressed_x = init_json["Key pressed line"]["X"].get<int>();
-        key_pressed_y = init_json["Key pressed line"]["Y"].get<int>();
-        for(int i = 0; i < 8; i++)
-        {
-                key_code_x[i] = init_json["Key code lane"][i]["X"].get<int>();
-                key_code_y[i] = init_json["Key code lane"][i]["Y"].get<int>();
-        }
+        key_pressed_line = addOutputLane(laneFromJson(init_json["Key pressed line"]));
+        key_code_lane = addOutputLane(laneFromJson(init_json["Key code lane"]));
+        watchKeys();
 }
 
-void Keyboard::tick(const bool* stateR, bool* stateW, int w, int h)
+void Keyboard::tick(const LaneWord* in, LaneWord* out, bool* drive)
 {
-       if((stateW[key_pressed_y*w + key_pressed_x] = lgs::isAnyKeyPressed()))
+       drive[key_pressed_line] = true;
+       if((out[key_pressed_line] = lgs::isAnyKeyPressed()))
        {
-               int key = lgs::getAnyPressedKey();
-               for(int i = 0; i < 8; i++)
-               {
-                       stateW[key_code_y[i]*w + key_code_x[i]] = key%2 == 1;
-                       key /= 2;
-               }
+               out[key_code_lane] = (LaneWord) lgs::getAnyPressedKey();
+               drive[key_code_lane] = true;
        } 
 }
 
-CharStreamPrinter::CharStreamPrinter(const nlohmann::json& initJson) : Peripheral(initJson)
+CharStreamPrinter::CharStreamPrinter(const nlohmann::json& initJson) : ProcessPeripheral(initJson)
 {
-        print_line_prev = false;
-        print_line_x = initJson["Print line"]["X"].get<int>();
-        print_line_y = initJson["Print line"]["Y"].get<int>();
-        for(int i = 0; i < 8; i++)
-        {
-                char_lane_x[i] = initJson["Character lane"][i]["X"].get<int>();
-                char_lane_y[i] = initJson["Character lane"][i]["Y"].get<int>();
-        }
+        print_line = addInputLane(laneFromJson(initJson["Print line"]));
+        char_lane = addInputLane(laneFromJson(initJson["Character lane"]), false);
 }
 
-void CharStreamPrinter::tick(const bool* stateR, bool* stateW, int w, int h)
+void CharStreamPrinter::run()
 {
-        if(print_line_prev & !stateR[print_line_y*w + print_line_x])
+        LGS_PROCESS_BEGIN
+        while(true)
         {
-                unsigned int code = 0;
-                for(int i = 7; i >= 0; --i)
-                    code = code*2 + (stateR[char_lane_y[i]*w + char_lane_x[i]] ? 1 : 0);
-                if(code == 127) lgs::backspace();
-                else lgs::print(std::string(1, (char) code));
+                LGS_AWAIT(waitFallingEdge(print_line));
+                {
+                        unsigned int code = (unsigned int) (readLane(char_lane) & 0xFF);
+                        if(code == 127) lgs::backspace();
+                        else lgs::printOutput(std::string(1, (char) code));
 #ifdef DBG_PRINT
-                lgs::print("Printing character code ");
-                lgs::print(std::to_string(code));
-                lgs::print(" which looks like ");
-                lgs::print(std::string(1, (char) code));
-                lgs::print("\n");
+                        lgs::print("Printing character code ");
+                        lgs::print(std::to_string(code));
+                        lgs::print(" which looks like ");
+                        lgs::print(std::string(1, (char) code));
+                        lgs::print("\n");
 #endif
+                }
+        }
+        LGS_PROCESS_END
+}
+
+Memory::Memory(const nlohmann::json& initJson) : Peripheral(initJson), data_in_lane(-1), write_line(-1), write_prev(false), data(NULL), 
+        data_size(0), map_size(0)
+{
+        Lane address = laneFromJson(initJson["Address lane"]);
+        Lane data_out = laneFromJson(initJson["Data out lane"]);
+        if(address.size() > LGS_MEMORY_MAX_ADDRESS_BITS)
+        {
+                lgs::print("Memory address lane is wider than " + std::to_string(LGS_MEMORY_MAX_ADDRESS_BITS) + " bits\n");
+                lgs::exitNcursesMode(true);
+        }
+        address_lane = addInputLane(address);
+        data_out_lane = addOutputLane(data_out);
+        watchInputLane(address_lane);
+        address_mask = address.size() == LGS_LANE_MAX_BITS ? ~(LaneWord) 0 : ((LaneWord) 1 << address.size()) - 1;
+        data_mask = data_out.size() == LGS_LANE_MAX_BITS ? ~(LaneWord) 0 : ((LaneWord) 1 << data_out.size()) - 1;
+        word_bytes = (data_out.size() + 7) / 8;
+        std::size_t size = ((std::size_t) 1 << address.size()) * word_bytes;
+
+        bool writable = initJson.find("Writable") != initJson.end() && initJson["Writable"].get<bool>();
+        bool persistent = initJson.find("Persistent") != initJson.end() && initJson["Persistent"].get<bool>();
+        if(writable)
+        {
+                data_in_lane = addInputLane(laneFromJson(initJson["Data in lane"]));
+                write_line = addInputLane(laneFromJson(initJson["Write line"]));
+                watchInputLane(write_line);
+        }
+
+        std::string path = initJson["File"].get<std::string>();
+        int fd = open(path.c_str(), writable && persistent ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+        struct stat file_stat;
+        if((fd < 0 && !(writable && errno == ENOENT)) || (fd >= 0 && fstat(fd, &file_stat) != 0))
+        {
+                lgs::print("Failed to open memory file " + path + "\n");
+                lgs::exitNcursesMode(true);
+        }
+        std::size_t file_size = fd >= 0 ? (std::size_t) file_stat.st_size : 0;
+
+        void* mapped = MAP_FAILED;
+        if(!writable)
+        {
+                // ROM, map no further than the end of the file
+                map_size = data_size = file_size < size ? file_size : size;
+                if(map_size > 0) mapped = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        else if(persistent)
+        {
+                map_size = data_size = size;
+                if(file_size < size && ftruncate(fd, size) != 0)
+                {
+                        lgs::print("Failed to extend memory file " + path + "\n");
+                        lgs::exitNcursesMode(true);
+                }
+                mapped = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        else
+        {
+                // Volatile RAM, an anonymous mapping loaded with the file
+                map_size = data_size = size;
+                mapped = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if(mapped != MAP_FAILED && fd >= 0)
+                {
+                        std::size_t n_read = 0;
+                        ssize_t r;
+                        while(n_read < size && (r = pread(fd, (unsigned char*) mapped + n_read, size - n_read, n_read)) > 0)
+                                n_read += r;
+                }
         }
-        print_line_prev = stateR[print_line_y*w + print_line_x];
+        if(map_size > 0 && mapped == MAP_FAILED)
+        {
+                lgs::print("Failed to map memory file " + path + "\n");
+                lgs::exitNcursesMode(true);
+        }
+        if(map_size > 0) data = (unsigned char*) mapped;
+        if(fd >= 0) close(fd);
+}
+
+Memory::Memory(Memory&& other) : Peripheral(other), address_lane(other.address_lane), data_in_lane(other.data_in_lane), 
+        write_line(other.write_line), data_out_lane(other.data_out_lane), word_bytes(other.word_bytes), address_mask(other.address_mask), 
+        data_mask(other.data_mask), write_prev(other.write_prev), data(other.data), data_size(other.data_size), map_size(other.map_size)
+{
+        other.data = NULL;
+        other.map_size = 0;
+}
+
+Memory::~Memory()
+{
+        if(data != NULL) munmap(data, map_size);
+}
+
+void Memory::tick(const LaneWord* in, LaneWord* out, bool* drive)
+{
+        std::size_t offset = (std::size_t) (in[address_lane] & address_mask) * word_bytes;
+        if(write_line >= 0)
+        {
+                bool write = (in[write_line] & 1) != 0;
+                if(write && !write_prev)
+                {
+                        LaneWord word = in[data_in_lane];
+                        for(int i = 0; i < word_bytes; i++, word >>= 8)
+                                data[offset + i] = (unsigned char) (word & 0xFF);
+                }
+                write_prev = write;
+        }
+        LaneWord word = 0;
+        for(int i = word_bytes - 1; i >= 0; --i)
+                word = (word << 8) | (offset + i < data_size ? data[offset + i] : 0);
+        out[data_out_lane] = word & data_mask;
+        drive[data_out_lane] = true;
+}
+
+FileReader::FileReader(const nlohmann::json& initJson) : Peripheral(initJson), end_line(-1), next_prev(false), has_byte(false), byte(0)
+{
+        data_lane = addOutputLane(laneFromJson(initJson["Data lane"]));
+        valid_line = addOutputLane(laneFromJson(initJson["Valid line"]));
+        if(initJson.find("End line") != initJson.end())
+                end_line = addOutputLane(laneFromJson(initJson["End line"]));
+        next_line = addInputLane(laneFromJson(initJson["Next line"]));
+        watchInputLane(next_line);
+        stream = new FileStream(initJson["File"].get<std::string>(), false);
+}
+
+FileReader::FileReader(FileReader&& other) : Peripheral(other), data_lane(other.data_lane), valid_line(other.valid_line), 
+        end_line(other.end_line), next_line(other.next_line), next_prev(other.next_prev), has_byte(other.has_byte), byte(other.byte), 
+        stream(other.stream)
+{
+        other.stream = NULL;
+}
+
+FileReader::~FileReader() { delete stream; }
+
+void FileReader::tick(const LaneWord* in, LaneWord* out, bool* drive)
+{
+        bool next = (in[next_line] & 1) != 0;
+        if(next_prev && !next) has_byte = false;
+        next_prev = next;
+        if(!has_byte) has_byte = stream->read(byte);
+
+        bool ended = !has_byte && stream->atEnd();
+        if(ended && stream->hasFailed()) fail("Failed to read file " + stream->getPath() + "\n");
+        out[data_lane] = has_byte ? byte : 0;
+        out[valid_line] = has_byte;
+        drive[data_lane] = drive[valid_line] = true;
+        if(end_line >= 0)
+        {
+                out[end_line] = ended;
+                drive[end_line] = true;
+        }
+        if(!has_byte && !ended) wakeAfter(1);           // Poll the buffer until the background thread catches up.
+}
+
+FileWriter::FileWriter(const nlohmann::json& initJson) : Peripheral(initJson), ready_line(-1), write_prev(false)
+{
+        data_lane = addInputLane(laneFromJson(initJson["Data lane"]));
+        write_line = addInputLane(laneFromJson(initJson["Write line"]));
+        watchInputLane(write_line);
+        if(initJson.find("Ready line") != initJson.end())
+                ready_line = addOutputLane(laneFromJson(initJson["Ready line"]));
+        stream = new FileStream(initJson["File"].get<std::string>(), true);
+}
+
+FileWriter::FileWriter(FileWriter&& other) : Peripheral(other), data_lane(other.data_lane), write_line(other.write_line), 
+        ready_line(other.ready_line), write_prev(other.write_prev), stream(other.stream)
+{
+        other.stream = NULL;
+}
+
+FileWriter::~FileWriter() { delete stream; }
+
+void FileWriter::tick(const LaneWord* in, LaneWord* out, bool* drive)
+{
+        bool write = (in[write_line] & 1) != 0;
+        if(write_prev && !write && !stream->write((unsigned char) (in[data_lane] & 0xFF)))
+        {
+                // A circuit given a Ready line is expected to wait on it, so a byte that does not fit is its error. Without one there
+                // is no other backpressure, so the tick waits for the background thread to make room rather than lose the byte.
+                if(ready_line >= 0) fail("FileWriter wrote to " + stream->getPath() + " while its Ready line was low\n");
+                else
+                        while(!stream->write((unsigned char) (in[data_lane] & 0xFF)))
+                                std::this_thread::yield();
+        }
+        write_prev = write;
+        if(stream->hasFailed()) fail("Failed to write file " + stream->getPath() + "\n");
+        if(ready_line >= 0)
+        {
+                out[ready_line] = stream->canWrite();
+                drive[ready_line] = true;
+                if(!out[ready_line]) wakeAfter(1);      // Poll the buffer until the background thread makes room.
+        }
+}
+
+void FileWriter::finish()
+{
+        stream->close();
+        if(stream->hasFailed()) fail("Failed to write file " + stream->getPath() + "\n");
+}
+
+Display::Display(const nlohmann::json& initJson) : Peripheral(initJson), period(1), scale(1)
+{
+        bits_per_pixel = initJson.find("Bits per pixel") != initJson.end() ? initJson["Bits per pixel"].get<int>() : 1;
+        if(bits_per_pixel != 1 && bits_per_pixel != 2 && bits_per_pixel != 4 && bits_per_pixel != 8)
+        {
+                lgs::print("Display bits per pixel must be 1, 2, 4 or 8\n");
+                lgs::exitNcursesMode(true);
+        }
+        if(initJson.find("Period") != initJson.end()) period = initJson["Period"].get<int>();
+        if(initJson.find("Scale") != initJson.end()) scale = initJson["Scale"].get<int>();
+        if(period < 1 || scale < 1)
+        {
+                lgs::print("Display period and scale must be positive\n");
+                lgs::exitNcursesMode(true);
+        }
+
+        // Rows, split into lanes of at most LGS_LANE_MAX_BITS bits
+        int row_bits = 0;
+        if(initJson.find("Region") != initJson.end())
+        {
+                const nlohmann::json& region = initJson["Region"];
+                int x = region["X"].get<int>(), y = region["Y"].get<int>();
+                row_bits = region["Width"].get<int>();
+                height = region["Height"].get<int>();
+                lanes_per_row = (row_bits + LGS_LANE_MAX_BITS - 1) / LGS_LANE_MAX_BITS;
+                for(int j = 0; j < height; j++)
+                        for(int c = 0; c < lanes_per_row; c++)
+                        {
+                                std::vector<std::pair<int, int>> bits;
+                                for(int i = c*LGS_LANE_MAX_BITS; i < row_bits && i < (c+1)*LGS_LANE_MAX_BITS; i++)
+                                        bits.push_back(std::pair<int, int>(x + i, y + j));
+                                addInputLane(Lane(bits));
+                        }
+        }
+        else
+        {
+                const nlohmann::json& rows = initJson["Rows"];
+                lanes_per_row = 1;
+                height = rows.size();
+                for(nlohmann::json::const_iterator row = rows.begin(); row != rows.end(); ++row)
+                {
+                        Lane lane = laneFromJson(*row);
+                        if(row != rows.begin() && lane.size() != row_bits)
+                        {
+                                lgs::print("Display rows must all be of the same length\n");
+                                lgs::exitNcursesMode(true);
+                        }
+                        row_bits = lane.size();
+                        addInputLane(lane);
+                }
+        }
+        width = row_bits / bits_per_pixel;
+        stopPolling();
+
+        int n_colors = 1 << bits_per_pixel;
+        if(initJson.find("Palette") != initJson.end())
+        {
+                const nlohmann::json& colors = initJson["Palette"];
+                if((int) colors.size() != n_colors)
+                {
+                        lgs::print("Display palette must have " + std::to_string(n_colors) + " colors\n");
+                        lgs::exitNcursesMode(true);
+                }
+                for(nlohmann::json::const_iterator color = colors.begin(); color != colors.end(); ++color)
+                        for(int k = 0; k < 3; k++)
+                                palette.push_back((unsigned char) (*color)[k].get<int>());
+        }
+        else for(int i = 0; i < n_colors; i++)
+                for(int k = 0; k < 3; k++)
+                        palette.push_back((unsigned char) (i * 255 / (n_colors - 1)));
+
+        std::string header = "P6\n" + std::to_string(width*scale) + " " + std::to_string(height*scale) + "\n255\n";
+        header_size = header.size();
+        frame.resize(header_size + (std::size_t) width*scale * height*scale * 3);
+        std::copy(header.begin(), header.end(), frame.begin());
+        stream = new FileStream(initJson["File"].get<std::string>(), true);
+}
+
+Display::Display(Display&& other) : Peripheral(other), width(other.width), height(other.height), lanes_per_row(other.lanes_per_row), 
+        bits_per_pixel(other.bits_per_pixel), period(other.period), scale(other.scale), palette(std::move(other.palette)), 
+        frame(std::move(other.frame)), header_size(other.header_size), stream(other.stream)
+{
+        other.stream = NULL;
+}
+
+Display::~Display() { delete stream; }
+
+void Display::tick(const LaneWord* in, LaneWord* out, bool* drive)
+{
+        LaneWord pixel_mask = ((LaneWord) 1 << bits_per_pixel) - 1;
+        int pixels_per_lane = LGS_LANE_MAX_BITS / bits_per_pixel;
+        int line = width*scale*3;
+        unsigned char* image = frame.data() + header_size;
+        for(int j = 0; j < height; j++)
+        {
+                // Draw the first image row of display row j, then copy it for the rest
+                unsigned char* row = image + (std::size_t) j*scale*line;
+                for(int i = 0; i < width; i++)
+                {
+                        LaneWord word = in[j*lanes_per_row + i / pixels_per_lane];
+                        const unsigned char* color = &palette[3 * ((word >> ((i % pixels_per_lane) * bits_per_pixel)) & pixel_mask)];
+                        for(int k = 0; k < scale; k++)
+                        {
+                                row[(i*scale + k)*3] = color[0];
+                                row[(i*scale + k)*3 + 1] = color[1];
+                                row[(i*scale + k)*3 + 2] = color[2];
+                        }
+                }
+                for(int k = 1; k < scale; k++)
+                        std::copy(row, row + line, row + k*line);
+        }
+        stream->writeAll(frame.data(), frame.size());
+        if(stream->hasFailed()) fail("Failed to write display file " + stream->getPath() + "\n");
+        wakeAfter(period);
+}
+
+void Display::finish()
+{
+        stream->close();
+        if(stream->hasFailed()) fail("Failed to write display file " + stream->getPath() + "\n");
+}
+
+SerialPort::SerialPort(const nlohmann::json& initJson) : Peripheral(initJson), tx_prev(false), recv_bit(-1), recv_byte(0), recv_next(0), 
+        send_bit(-1), send_byte(0), send_next(0), log(NULL)
+{
+        tx_line = addInputLane(laneFromJson(initJson["TX line"]));
+        rx_line = addOutputLane(laneFromJson(initJson["RX line"]));
+        watchInputLane(tx_line);
+        ticks_per_bit = initJson["Ticks per bit"].get<int>();
+        if(ticks_per_bit < 2)
+        {
+                lgs::print("Serial port needs at least 2 ticks per bit\n");
+                lgs::exitNcursesMode(true);
+        }
+        link = new SerialLink(initJson.find("Socket") != initJson.end() ? initJson["Socket"].get<std::string>() : std::string());
+        lgs::print("Serial port on " + link->getName() + "\n");
+        if(initJson.find("Log") != initJson.end())
+                log = new FileStream(initJson["Log"].get<std::string>(), true);
+}
+
+SerialPort::SerialPort(SerialPort&& other) : Peripheral(other), tx_line(other.tx_line), rx_line(other.rx_line), 
+        ticks_per_bit(other.ticks_per_bit), tx_prev(other.tx_prev), recv_bit(other.recv_bit), recv_byte(other.recv_byte), 
+        recv_next(other.recv_next), send_bit(other.send_bit), send_byte(other.send_byte), send_next(other.send_next), link(other.link), 
+        log(other.log)
+{
+        other.link = NULL;
+        other.log = NULL;
+}
+
+SerialPort::~SerialPort()
+{
+        delete link;
+        delete log;
+}
+
+void SerialPort::log_byte(const char* direction, unsigned char byte)
+{
+        if(log == NULL) return;
+        std::string line = std::to_string(getTickNumber()) + " " + direction + " " + std::to_string(byte) + "\n";
+        log->writeAll((const unsigned char*) line.data(), line.size());
+}
+
+void SerialPort::tick(const LaneWord* in, LaneWord* out, bool* drive)
+{
+        long int now = getTickNumber();
+
+        // Receive from the circuit, sampling the middle of each bit after the falling edge of the start bit
+        bool tx = (in[tx_line] & 1) != 0;
+        if(recv_bit < 0)
+        {
+                if(tx_prev && !tx)
+                {
+                        recv_bit = 0;
+                        recv_byte = 0;
+                        recv_next = now + ticks_per_bit + ticks_per_bit/2;
+                }
+        }
+        else if(now == recv_next)
+        {
+                if(recv_bit < 8)
+                {
+                        if(tx) recv_byte |= 1 << recv_bit;
+                        ++recv_bit;
+                        recv_next += ticks_per_bit;
+                }
+                else
+                {
+                        if(tx && link->send(recv_byte)) log_byte("out", recv_byte);
+                        recv_bit = -1;
+                }
+        }
+        tx_prev = tx;
+
+        // Send to the circuit
+        if(send_bit >= 0 && now == send_next)
+        {
+                send_bit = send_bit < 9 ? send_bit + 1 : -1;
+                send_next += ticks_per_bit;
+        }
+        if(send_bit < 0 && link->receive(send_byte))
+        {
+                send_bit = 0;
+                send_next = now + ticks_per_bit;
+                log_byte("in", send_byte);
+        }
+        out[rx_line] = send_bit < 0 || send_bit == 9 || (send_bit > 0 && ((send_byte >> (send_bit - 1)) & 1));
+        drive[rx_line] = true;
+
+        // Sleep until the next bit, polling the link once a bit while idle
+        long int next = send_bit >= 0 ? send_next : now + ticks_per_bit;
+        if(recv_bit >= 0 && recv_next < next) next = recv_next;
+        wakeAfter((int) (next - now));
+}
+
+void SerialPort::finish()
+{
+        link->close();
+        if(log != NULL) log->close();
 }
 
 Peripheral* lgs::peripheralFromJson(const nlohmann::json& periJson)
@@ -154,6 +799,11 @@ Peripheral* lgs::peripheralFromJson(const nlohmann::json& periJson)
         else if(cls == std::string("Clock")) return new Clock(periJson["Initializer"]);
         else if(cls == std::string("Keyboard")) return new Keyboard(periJson["Initializer"]);
         else if(cls == std::string("CharStreamPrinter")) return new CharStreamPrinter(periJson["Initializer"]);
+        else if(cls == std::string("Memory")) return new Memory(periJson["Initializer"]);
+        else if(cls == std::string("FileReader")) return new FileReader(periJson["Initializer"]);
+        else if(cls == std::string("FileWriter")) return new FileWriter(periJson["Initializer"]);
+        else if(cls == std::string("Display")) return new Display(periJson["Initializer"]);
+        else if(cls == std::string("SerialPort")) return new SerialPort(periJson["Initializer"]);
         else 
         {
                 lgs::print("Unknown Peripheral class: ");
@@ -163,3 +813,110 @@ Peripheral* lgs::peripheralFromJson(const nlohmann::json& periJson)
         }
         return NULL;
 }
+
+/*
+ * Access to a peripheral of a batch, stored by value or by pointer.
+ */
+template<class T> static inline T& batchPeripheral(T& peripheral) { return peripheral; }
+template<class T> static inline T& batchPeripheral(T* peripheral) { return *peripheral; }
+
+template<class T> void PeripheralSet::add(Batch<T>& batch, const nlohmann::json& initJson)
+{
+        batch.peripherals.emplace_back(initJson);
+        batch.index.push_back(all.size());
+        all.push_back(&batch.peripherals.back());
+}
+
+PeripheralSet::PeripheralSet(const nlohmann::json& peripheralsJson)
+{
+        // Reserve first, so that pointers into the batches stay valid
+        std::map<std::string, int> counts;
+        for(nlohmann::json::const_iterator i = peripheralsJson.begin(); i != peripheralsJson.end(); ++i)
+                ++counts[(*i)["Class"].get<std::string>()];
+        led_arrays.peripherals.reserve(counts["LEDArray"]);
+        bit_switch_arrays.peripherals.reserve(counts["BitSwitchArray"]);
+        clocks.peripherals.reserve(counts["Clock"]);
+        keyboards.peripherals.reserve(counts["Keyboard"]);
+        char_stream_printers.peripherals.reserve(counts["CharStreamPrinter"]);
+        memories.peripherals.reserve(counts["Memory"]);
+        file_readers.peripherals.reserve(counts["FileReader"]);
+        file_writers.peripherals.reserve(counts["FileWriter"]);
+        displays.peripherals.reserve(counts["Display"]);
+        serial_ports.peripherals.reserve(counts["SerialPort"]);
+
+        for(nlohmann::json::const_iterator i = peripheralsJson.begin(); i != peripheralsJson.end(); ++i)
+        {
+                std::string cls = (*i)["Class"].get<std::string>();
+                if(cls == std::string("LEDArray")) add(led_arrays, (*i)["Initializer"]);
+                else if(cls == std::string("BitSwitchArray")) add(bit_switch_arrays, (*i)["Initializer"]);
+                else if(cls == std::string("Clock")) add(clocks, (*i)["Initializer"]);
+                else if(cls == std::string("Keyboard")) add(keyboards, (*i)["Initializer"]);
+                else if(cls == std::string("CharStreamPrinter")) add(char_stream_printers, (*i)["Initializer"]);
+                else if(cls == std::string("Memory")) add(memories, (*i)["Initializer"]);
+                else if(cls == std::string("FileReader")) add(file_readers, (*i)["Initializer"]);
+                else if(cls == std::string("FileWriter")) add(file_writers, (*i)["Initializer"]);
+                else if(cls == std::string("Display")) add(displays, (*i)["Initializer"]);
+                else if(cls == std::string("SerialPort")) add(serial_ports, (*i)["Initializer"]);
+                else addPeripheral(peripheralFromJson(*i));
+        }
+}
+
+PeripheralSet::~PeripheralSet()
+{
+        for(std::vector<Peripheral*>::iterator p = others.peripherals.begin(); p != others.peripherals.end(); ++p)
+                delete *p;
+}
+
+void PeripheralSet::addPeripheral(Peripheral* peripheral)
+{
+        others.peripherals.push_back(peripheral);
+        others.index.push_back(all.size());
+        all.push_back(peripheral);
+}
+
+const std::vector<Peripheral*>& PeripheralSet::getPeripherals() const { return all; }
+
+void PeripheralSet::finish()
+{
+        for(std::vector<Peripheral*>::iterator p = all.begin(); p != all.end(); ++p)
+                (*p)->finish();
+
+        // Called from the main thread once ticking is over, so errors are reported here rather than by the Simulation
+        bool failed = false;
+        for(std::vector<Peripheral*>::iterator p = all.begin(); p != all.end(); ++p)
+        {
+                lgs::print((*p)->getError());
+                failed = failed || !(*p)->getError().empty();
+        }
+        if(failed) lgs::exitNcursesMode(true);
+}
+
+template<class T> void PeripheralSet::tick_batch(Batch<T>& batch, const char* due, long int tickNumber, const LaneWord* in, 
+                LaneWord* out, bool* drive, const int* inputBase, const int* outputBase, int* wake)
+{
+        // For T a final class the calls below are direct
+        for(typename std::vector<T>::size_type i = 0; i < batch.peripherals.size(); i++)
+        {
+                int p = batch.index[i];
+                if(!due[p]) continue;
+                batchPeripheral(batch.peripherals[i]).tick_number = tickNumber;
+                batchPeripheral(batch.peripherals[i]).tick(in + inputBase[p], out + outputBase[p], drive + outputBase[p]);
+                wake[p] = batchPeripheral(batch.peripherals[i]).takeWakeRequest();
+        }
+}
+
+void PeripheralSet::tick(const char* due, long int tickNumber, const LaneWord* in, LaneWord* out, bool* drive, 
+                const int* inputBase, const int* outputBase, int* wake)
+{
+        tick_batch(led_arrays, due, tickNumber, in, out, drive, inputBase, outputBase, wake);
+        tick_batch(bit_switch_arrays, due, tickNumber, in, out, drive, inputBase, outputBase, wake);
+        tick_batch(clocks, due, tickNumber, in, out, drive, inputBase, outputBase, wake);
+        tick_batch(keyboards, due, tickNumber, in, out, drive, inputBase, outputBase, wake);
+        tick_batch(char_stream_printers, due, tickNumber, in, out, drive, inputBase, outputBase, wake);
+        tick_batch(memories, due, tickNumber, in, out, drive, inputBase, outputBase, wake);
+        tick_batch(file_readers, due, tickNumber, in, out, drive, inputBase, outputBase, wake);
+        tick_batch(file_writers, due, tickNumber, in, out, drive, inputBase, outputBase, wake);
+        tick_batch(displays, due, tickNumber, in, out, drive, inputBase, outputBase, wake);
+        tick_batch(serial_ports, due, tickNumber, in, out, drive, inputBase, outputBase, wake);
+        tick_batch(others, due, tickNumber, in, out, drive, inputBase, outputBase, wake);
+}
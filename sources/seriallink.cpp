@@ -0,0 +1,164 @@
+/*
+ * Implementation for seriallink.hpp
+ */
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include <ncursesio.hpp>
+#include <logicsim.hpp>
+
+#include <seriallink.hpp>
+
+lgs::SerialLink::SerialLink(const std::string& socketPath) : to_board(LGS_SERIAL_BUFFER_SIZE), from_board(LGS_SERIAL_BUFFER_SIZE), 
+        listen_fd(-1), fd(-1), pty_slave_fd(-1), closing(false)
+{
+        if(!socketPath.empty())
+        {
+                struct sockaddr_un address;
+                std::memset(&address, 0, sizeof(address));
+                address.sun_family = AF_UNIX;
+                if(socketPath.size() >= sizeof(address.sun_path))
+                {
+                        lgs::print("Socket path too long: " + socketPath + "\n");
+                        lgs::exitNcursesMode(true);
+                }
+                std::strcpy(address.sun_path, socketPath.c_str());
+                unlink(socketPath.c_str());
+                listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+                if(listen_fd < 0 || bind(listen_fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(listen_fd, 1) != 0)
+                {
+                        lgs::print("Failed to listen on socket " + socketPath + "\n");
+                        lgs::exitNcursesMode(true);
+                }
+                fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+                name = socketPath;
+        }
+        else
+        {
+                fd = posix_openpt(O_RDWR | O_NOCTTY);
+                if(fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0 || ptsname(fd) == NULL)
+                {
+                        lgs::print("Failed to open a pseudo terminal\n");
+                        lgs::exitNcursesMode(true);
+                }
+                name = ptsname(fd);
+                pty_slave_fd = open(name.c_str(), O_RDWR | O_NOCTTY);
+                struct termios mode;
+                if(pty_slave_fd >= 0 && tcgetattr(pty_slave_fd, &mode) == 0)
+                {
+                        cfmakeraw(&mode);
+                        tcsetattr(pty_slave_fd, TCSANOW, &mode);
+                }
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+        }
+        worker = std::thread(&lgs::SerialLink::run, this);
+}
+
+lgs::SerialLink::~SerialLink()
+{
+        close();
+}
+
+void lgs::SerialLink::transfer(bool readable, bool writable)
+{
+        unsigned char chunk[4096];
+        if(readable)
+        {
+                std::size_t room = to_board.capacity() - to_board.size();
+                ssize_t n = read(fd, chunk, room < sizeof(chunk) ? room : sizeof(chunk));
+                if(n > 0) to_board.pushSome(chunk, n);
+                else if(listen_fd >= 0 && (n == 0 || (errno != EAGAIN && errno != EINTR)))
+                {
+                        // Peer gone. A socket goes back to accepting, a terminal stays open through pty_slave_fd.
+                        disconnect();
+                        return;
+                }
+        }
+        if(pending.empty())
+        {
+                std::size_t n = from_board.popSome(chunk, sizeof(chunk));
+                pending.assign(chunk, chunk + n);
+        }
+        if(writable && !pending.empty())
+        {
+                // With MSG_NOSIGNAL a socket peer that went away gives EPIPE, instead of a SIGPIPE that would kill the simulator
+                ssize_t n = listen_fd >= 0 ? ::send(fd, pending.data(), pending.size(), MSG_NOSIGNAL) : write(fd, pending.data(), pending.size());
+                if(n > 0) pending.erase(pending.begin(), pending.begin() + n);
+                else if(n < 0 && listen_fd >= 0 && errno != EAGAIN && errno != EINTR) disconnect();
+        }
+}
+
+void lgs::SerialLink::disconnect()
+{
+        ::close(fd);
+        fd = -1;
+        pending.clear();
+}
+
+void lgs::SerialLink::run()
+{
+        while(!closing.load())
+        {
+                if(fd < 0)
+                {
+                        struct pollfd listener = { listen_fd, POLLIN, 0 };
+                        if(poll(&listener, 1, LGS_SERIAL_POLL_TIME) > 0)
+                        {
+                                fd = accept(listen_fd, NULL, NULL);
+                                if(fd >= 0) fcntl(fd, F_SETFL, O_NONBLOCK);
+                        }
+                        continue;
+                }
+                if(pending.empty())
+                {
+                        unsigned char chunk[4096];
+                        std::size_t n = from_board.popSome(chunk, sizeof(chunk));
+                        pending.assign(chunk, chunk + n);
+                }
+                struct pollfd connection = { fd, 0, 0 };
+                if(to_board.size() < to_board.capacity()) connection.events |= POLLIN;
+                if(!pending.empty()) connection.events |= POLLOUT;
+                if(poll(&connection, 1, LGS_SERIAL_POLL_TIME) > 0)
+                        transfer((connection.revents & (POLLIN | POLLHUP | POLLERR)) != 0, (connection.revents & POLLOUT) != 0);
+        }
+        // Best effort at writing out what the board sent last, without waiting long on a stalled peer
+        for(int i = 0; fd >= 0 && i < 100 && (!pending.empty() || from_board.size() > 0); i++)
+        {
+                struct pollfd connection = { fd, POLLOUT, 0 };
+                if(poll(&connection, 1, LGS_SERIAL_POLL_TIME) <= 0) break;
+                transfer(false, true);
+        }
+}
+
+const std::string& lgs::SerialLink::getName() const { return name; }
+
+bool lgs::SerialLink::receive(unsigned char& byte) { return to_board.pop(byte); }
+
+bool lgs::SerialLink::send(unsigned char byte) { return from_board.push(byte); }
+
+void lgs::SerialLink::close()
+{
+        if(!worker.joinable()) return;
+        closing.store(true);
+        worker.join();
+        if(fd >= 0) ::close(fd);
+        if(listen_fd >= 0)
+        {
+                ::close(listen_fd);
+                unlink(name.c_str());
+        }
+        if(pty_slave_fd >= 0) ::close(pty_slave_fd);
+}
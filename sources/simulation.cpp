@@ -0,0 +1,314 @@
+/*
+ * Implementation for simulation.hpp
+ */
+
+#include <vector>
+#include <utility>
+#include <atomic>
+#include <thread>
+#include <climits>
+
+#include <lane.hpp>
+#include <peripherals.hpp>
+#include <engine.hpp>
+#include <logicsim.hpp>
+#include <ncursesio.hpp>
+
+#ifdef LGS_PROFILE
+#include <chrono>
+#include <string>
+#include <sstream>
+#endif
+
+#include <simulation.hpp>
+
+lgs::Simulation::Simulation(Engine* eng, const int w, const int h, PeripheralSet& ps, const int pipelineDepth)
+        : engine(eng), peripherals(ps), width(w), height(h), pipeline_depth(pipelineDepth), n_ticks(0), n_polling(0), n_watching_keys(0), 
+          n_skipped(0), max_lazy(0), peripheral_ticks(0), log_step(0), slots(NULL), stopping(false), failed(false)
+{
+        const std::vector<Peripheral*>& all = peripherals.getPeripherals();
+        for(std::vector<Peripheral*>::const_iterator peri = all.begin(); peri != all.end(); ++peri)
+        {
+                input_base.push_back(input_lanes.size());
+                output_base.push_back(output_lanes.size());
+                const std::vector<Lane>& ins = (*peri)->getInputLanes();
+                const std::vector<Lane>& outs = (*peri)->getOutputLanes();
+                for(std::vector<Lane>::const_iterator l = ins.begin(); l != ins.end(); ++l)
+                        input_lanes.add(*l, w, h);
+                for(std::vector<Lane>::const_iterator l = outs.begin(); l != outs.end(); ++l)
+                        output_lanes.add(*l, w, h);
+                watch_begins.push_back(watch_lanes.size());
+                const std::vector<int>& watched = (*peri)->getWatchedLanes();
+                for(std::vector<int>::const_iterator l = watched.begin(); l != watched.end(); ++l)
+                        watch_lanes.push_back(input_base.back() + *l);
+                polling.push_back((*peri)->isPolling());
+                watching_keys.push_back((*peri)->isWatchingKeys());
+                n_polling += polling.back();
+                n_watching_keys += watching_keys.back();
+                wake_tick.push_back(-1);
+
+                // Lanes a sleeping peripheral does not watch are only gathered when it is due
+                lazy_lanes.push_back(LaneSet());
+                lazy_index.push_back(std::vector<int>());
+                for(int l = 0; l < (int) ins.size(); l++)
+                {
+                        bool is_watched = polling.back();
+                        for(std::vector<int>::const_iterator i = watched.begin(); i != watched.end(); ++i)
+                                is_watched = is_watched || *i == l;
+                        LaneSet& set = is_watched ? eager_lanes : lazy_lanes.back();
+                        std::vector<int>& index = is_watched ? eager_index : lazy_index.back();
+                        set.add(ins[l], w, h);
+                        index.push_back(input_base.back() + l);
+                }
+                if(lazy_lanes.back().size() > max_lazy) max_lazy = lazy_lanes.back().size();
+        }
+        input_base.push_back(input_lanes.size());
+        output_base.push_back(output_lanes.size());
+        watch_begins.push_back(watch_lanes.size());
+        due.resize(all.size());
+        wake.resize(all.size());
+        in_words = new LaneWord[input_lanes.size()];
+        eager_words = new LaneWord[eager_lanes.size()];
+        lazy_words = new LaneWord[max_lazy];
+        for(int i = 0; i < input_lanes.size(); i++)
+                in_words[i] = 0;
+        prev_in_words = new LaneWord[input_lanes.size()];
+        out_words = new LaneWord[output_lanes.size()];
+        drive = new bool[output_lanes.size()];
+        for(int i = 0; i < output_lanes.size(); i++)
+        {
+                out_words[i] = 0;
+                drive[i] = false;
+        }
+
+        if(pipeline_depth > 0)
+        {
+                slots = new PipelineSlot[pipeline_depth + 1];
+                for(int i = 0; i <= pipeline_depth; i++)
+                {
+                        slots[i].inputs = new LaneWord[input_lanes.size()];
+                        slots[i].outputs = new LaneWord[output_lanes.size()];
+                        slots[i].drive = new bool[output_lanes.size()];
+                        slots[i].published.store(-1);
+                        slots[i].done.store(-1);
+                }
+                peripheral_thread = std::thread(&lgs::Simulation::run_peripherals, this);
+        }
+#ifdef LGS_PROFILE
+        profile_n_ticks = 0;
+        profile_time_logic = std::chrono::steady_clock::duration(0);
+        profile_time_peripherals = std::chrono::steady_clock::duration(0);
+        prof_sec = new lgs::PrintSection();
+#endif
+}
+
+lgs::Simulation::~Simulation()
+{
+        drain();
+        if(slots != NULL)
+                for(int i = 0; i <= pipeline_depth; i++)
+                {
+                        delete[] slots[i].inputs;
+                        delete[] slots[i].outputs;
+                        delete[] slots[i].drive;
+                }
+        delete[] slots;
+        delete[] in_words;
+        delete[] eager_words;
+        delete[] lazy_words;
+        delete[] prev_in_words;
+        delete[] out_words;
+        delete[] drive;
+#ifdef LGS_PROFILE
+        delete prof_sec;
+#endif
+}
+
+void lgs::Simulation::tickSimulation()
+{
+#ifdef LGS_PROFILE
+        std::chrono::steady_clock::time_point t0, t1;
+        t0 = std::chrono::steady_clock::now();
+#endif 
+        engine->evaluate();
+#ifdef LGS_PROFILE 
+        t1 = std::chrono::steady_clock::now();
+        profile_time_logic += t1 - t0;
+#endif
+        if(pipeline_depth > 0)
+        {
+                // Scatter the writes made on the lanes of pipeline_depth ticks ago, then publish this tick's lanes in its slot.
+                long int t = n_ticks - pipeline_depth;
+                if(t >= 0)
+                {
+                        PipelineSlot& done_slot = slots[t % (pipeline_depth + 1)];
+                        while(done_slot.done.load(std::memory_order_acquire) != t)
+                        {
+                                if(failed.load(std::memory_order_acquire)) report_errors();
+                                std::this_thread::yield();
+                        }
+                        engine->scatterLanes(output_lanes, done_slot.outputs, done_slot.drive);
+                }
+                PipelineSlot& slot = slots[n_ticks % (pipeline_depth + 1)];
+                engine->gatherLanes(input_lanes, slot.inputs);
+                slot.published.store(n_ticks, std::memory_order_release);
+        }
+        else
+        {
+                if(max_lazy == 0) engine->gatherLanes(input_lanes, in_words);
+                else
+                {
+                        engine->gatherLanes(eager_lanes, eager_words);
+                        for(int i = 0; i < eager_lanes.size(); i++)
+                                in_words[eager_index[i]] = eager_words[i];
+                }
+                tick_peripherals(in_words, max_lazy > 0);
+                if(check_errors()) report_errors();
+                engine->scatterLanes(output_lanes, out_words, drive);
+        }
+        engine->commit();
+        ++n_ticks;
+#ifdef LGS_PROFILE
+        t0 = std::chrono::steady_clock::now();
+        profile_time_peripherals += t0 - t1;
+        ++profile_n_ticks;
+        if(profile_n_ticks >= LGS_PROFILE_N_SAMPLES)
+        {
+                profile_time_logic /= profile_n_ticks;
+                profile_time_peripherals /= profile_n_ticks;
+                std::stringstream str;
+                str << "Simulation Profiling.\n";
+                str << "Average tick time over " << profile_n_ticks << " ticks for logic tick is ";
+                str << std::chrono::duration_cast<std::chrono::microseconds>(profile_time_logic).count();
+                str << " microseconds and for peripheral tick is ";
+                str << std::chrono::duration_cast<std::chrono::microseconds>(profile_time_peripherals).count();
+                str << "microseconds.\n";
+                prof_sec->setText(str.str());
+                profile_n_ticks = 0;
+                profile_time_logic = std::chrono::steady_clock::duration(0);
+                profile_time_peripherals = std::chrono::steady_clock::duration(0);
+        }
+#endif
+}
+
+long int lgs::Simulation::getIdleTicks()
+{
+        if(pipeline_depth > 0 || n_ticks == 0 || n_polling > 0) return 0;
+        long int idle = LONG_MAX;
+        for(std::vector<long int>::size_type p = 0; p < wake_tick.size(); p++)
+                if(wake_tick[p] >= peripheral_ticks && wake_tick[p] - peripheral_ticks < idle) idle = wake_tick[p] - peripheral_ticks;
+        if(idle == 0 || (n_watching_keys > 0 && lgs::isKeyEventPending())) return 0;
+        return engine->isStable() ? idle : 0;
+}
+
+void lgs::Simulation::skipTicks(long int n)
+{
+        // The state is a fixed point and every peripheral would sit the ticks out, so only the tick counts move
+        // Nothing changes while idle, so only the first step passed can have anything to log
+        if(log_step > 0 && n > 0 && (peripheral_ticks + n) / log_step != peripheral_ticks / log_step)
+                lgs::logPrintSections((peripheral_ticks / log_step + 1) * log_step);
+        peripheral_ticks += n;
+        n_ticks += n;
+        n_skipped += n;
+        lgs::setKeyTick(peripheral_ticks);
+}
+
+void lgs::Simulation::setLogStep(long int step) { log_step = step > 0 ? step : 0; }
+
+bool lgs::Simulation::isWatchingKeys() { return n_watching_keys > 0; }
+
+long int lgs::Simulation::getSkippedTicks() { return n_skipped; }
+
+void lgs::Simulation::setEngine(Engine* eng)
+{
+        // The lanes belong to the simulation, so writes of the peripherals still in flight are scattered into the new engine
+        engine = eng;
+}
+
+const bool* lgs::Simulation::getState()
+{
+        return engine->getState();
+}
+
+void lgs::Simulation::tick_peripherals(LaneWord* in, bool gatherLazy)
+{
+        bool keys_changed = lgs::updateKeySnapshot(peripheral_ticks);
+        for(std::vector<char>::size_type p = 0; p < due.size(); p++)
+        {
+                bool is_due = peripheral_ticks == 0 || polling[p] || wake_tick[p] == peripheral_ticks || (keys_changed && watching_keys[p]);
+                for(int i = watch_begins[p]; !is_due && i < watch_begins[p+1]; i++)
+                        is_due = (in[watch_lanes[i]] ^ prev_in_words[watch_lanes[i]]) != 0;
+                due[p] = is_due;
+                if(!is_due) continue;
+                for(int i = output_base[p]; i < output_base[p+1]; i++)
+                        drive[i] = false;
+                if(gatherLazy && lazy_lanes[p].size() > 0)
+                {
+                        engine->gatherLanes(lazy_lanes[p], lazy_words);
+                        for(int i = 0; i < lazy_lanes[p].size(); i++)
+                                in[lazy_index[p][i]] = lazy_words[i];
+                }
+        }
+        peripherals.tick(due.data(), peripheral_ticks, in, out_words, drive, input_base.data(), output_base.data(), wake.data());
+        for(std::vector<char>::size_type p = 0; p < due.size(); p++)
+                if(due[p]) wake_tick[p] = wake[p] > 0 ? peripheral_ticks + wake[p] : -1;
+        for(int i = 0; i < input_lanes.size(); i++)
+                prev_in_words[i] = in[i];
+        ++peripheral_ticks;
+        if(log_step > 0 && peripheral_ticks % log_step == 0) lgs::logPrintSections(peripheral_ticks);
+}
+
+void lgs::Simulation::run_peripherals()
+{
+        for(long int t = 0; ; t++)
+        {
+                PipelineSlot& slot = slots[t % (pipeline_depth + 1)];
+                while(slot.published.load(std::memory_order_acquire) != t)
+                {
+                        if(stopping.load() && slot.published.load(std::memory_order_acquire) != t) return;
+                        std::this_thread::yield();
+                }
+                tick_peripherals(slot.inputs, false);
+                if(check_errors())
+                {
+                        // Leave the slot undone, the main thread sees the flag while waiting on it
+                        failed.store(true, std::memory_order_release);
+                        return;
+                }
+                for(int i = 0; i < output_lanes.size(); i++)
+                {
+                        slot.outputs[i] = out_words[i];
+                        slot.drive[i] = drive[i];
+                }
+                slot.done.store(t, std::memory_order_release);
+        }
+}
+
+bool lgs::Simulation::check_errors()
+{
+        const std::vector<Peripheral*>& all = peripherals.getPeripherals();
+        for(std::vector<char>::size_type p = 0; p < due.size(); p++)
+                if(due[p] && !all[p]->getError().empty()) return true;
+        return false;
+}
+
+void lgs::Simulation::report_errors()
+{
+        if(peripheral_thread.joinable())
+        {
+                stopping.store(true);
+                peripheral_thread.join();
+        }
+        const std::vector<Peripheral*>& all = peripherals.getPeripherals();
+        for(std::vector<Peripheral*>::const_iterator p = all.begin(); p != all.end(); ++p)
+                lgs::print((*p)->getError());
+        lgs::exitNcursesMode(true);
+}
+
+void lgs::Simulation::drain()
+{
+        if(!peripheral_thread.joinable()) return;
+        stopping.store(true);
+        peripheral_thread.join();
+        if(failed.load(std::memory_order_acquire)) report_errors();
+}
@@ -0,0 +1,24 @@
+/*
+ * Implementation for timesource.hpp
+ */
+
+#include <cmath>
+
+#include <timesource.hpp>
+
+static lgs::TimeMode time_mode = lgs::TIME_REAL;
+static double ticks_per_millisecond = 1.0;
+
+void lgs::setTimeMode(TimeMode mode, double ticksPerMillisecond)
+{
+        time_mode = mode;
+        ticks_per_millisecond = ticksPerMillisecond;
+}
+
+lgs::TimeMode lgs::getTimeMode() { return time_mode; }
+
+long int lgs::virtualMillisecondsToTicks(double milliseconds)
+{
+        long int ticks = std::lround(milliseconds * ticks_per_millisecond);
+        return ticks > 1 ? ticks : 1;
+}